@@ -23,34 +23,357 @@ static const struct ksu_feature_handler kernel_umount_handler = {
 
 extern int path_umount(struct path *path, int flags);
 
-static inline void ksu_umount_mnt(const char *mnt, struct path *path, int flags)
+static inline int ksu_umount_mnt(const char *mnt, struct path *path, int flags)
 {
 	int err = path_umount(path, flags);
-	if (err)
+	if (err && IS_ENABLED(CONFIG_KSU_DEBUG))
 		pr_info("umount %s failed: %d\n", mnt, err);
+	return err;
 }
 
-static void try_umount(const char *mnt, int flags)
+// 1 when umounted, 0 when there was nothing mounted there, -errno on failure
+static int try_umount(const char *mnt, int flags)
 {
 	struct path path;
 	int err = kern_path(mnt, 0, &path);
 	if (err) {
-		return;
+		return 0;
 	}
 
 	if (path.dentry != path.mnt->mnt_root) {
 		// it is not root mountpoint, maybe umounted by others already.
 		path_put(&path);
+		return 0;
+	}
+
+	err = ksu_umount_mnt(mnt, &path, flags);
+	return err ? err : 1;
+}
+
+/*
+ * monitoring, read only, racy increments are fine here
+ * performed / not_mounted / failed count entries of the walk, not_mounted
+ * being the ones with nothing mounted at the path anymore.
+ * ns_skipped counts whole walks saved by the clean namespace table
+ */
+static unsigned int ksu_umount_performed = 0;
+static unsigned int ksu_umount_not_mounted = 0;
+static unsigned int ksu_umount_failed = 0;
+static unsigned int ksu_umount_ns_skipped = 0;
+module_param(ksu_umount_performed, uint, 0444);
+module_param(ksu_umount_not_mounted, uint, 0444);
+module_param(ksu_umount_failed, uint, 0444);
+module_param(ksu_umount_ns_skipped, uint, 0444);
+
+/*
+ * latency histograms, bucket i counts calls that took [2^i, 2^(i+1)) ns.
+ * per cpu so the hot path is a plain increment, summed up on read
+ */
+struct umount_hist {
+	u64 call[KSU_UMOUNT_HIST_BUCKETS]; // whole ksu_handle_umount
+	u64 entry[KSU_UMOUNT_HIST_BUCKETS]; // one try_umount
+};
+
+static DEFINE_PER_CPU(struct umount_hist, ksu_umount_hist);
+
+static inline u32 umount_hist_bucket(u64 ns)
+{
+	return ns ? min_t(u32, fls64(ns) - 1, KSU_UMOUNT_HIST_BUCKETS - 1) : 0;
+}
+
+/*
+ * flattened copy of mount_list, rebuilt once per mount_list_gen.
+ * published under srcu, a zygote fork only enters a read section, so it
+ * takes no lock and touches no shared counter, mount_list_lock is never held
+ * across the umounts (path_umount can sleep on namespace_sem for a while)
+ * and the add/del supercalls don't stall behind app launches.
+ * targets keep the list order, the strings are packed right behind them.
+ */
+struct umount_target {
+	const char *path;
+	unsigned int flags;
+	u32 hash; // mount_entry hash, to carry the stats over to the next plan
+};
+
+// cost of one entry, path walk plus umount
+struct umount_cost {
+	u64 calls;
+	u64 total_ns;
+	u64 max_ns;
+};
+
+struct umount_plan {
+	struct rcu_head rcu;
+	unsigned long gen;
+	u32 count;
+	// per cpu, count entries each, NULL if that allocation failed
+	struct umount_cost __percpu *costs;
+	// what the previous plans measured, summed in on read
+	struct umount_cost *carried;
+	struct umount_target targets[];
+};
+
+static struct umount_plan __rcu *ksu_umount_plan = NULL;
+static DEFINE_MUTEX(umount_plan_mutex); // builders and the exit path
+DEFINE_STATIC_SRCU(umount_plan_srcu);
+
+static void umount_plan_free(struct umount_plan *plan)
+{
+	if (plan->costs)
+		free_percpu(plan->costs);
+	kvfree(plan->carried);
+	kvfree(plan);
+}
+
+static void umount_plan_free_rcu(struct rcu_head *rcu)
+{
+	umount_plan_free(container_of(rcu, struct umount_plan, rcu));
+}
+
+static inline void umount_target_account(struct umount_plan *plan, u32 i, u64 ns)
+{
+	struct umount_cost *c;
+
+	if (unlikely(!plan->costs))
+		return;
+
+	c = get_cpu_ptr(plan->costs) + i;
+	c->calls++;
+	c->total_ns += ns;
+	if (c->max_ns < ns)
+		c->max_ns = ns;
+	put_cpu_ptr(plan->costs);
+}
+
+// entry i summed over the carried part and every cpu
+static void umount_plan_cost(struct umount_plan *plan, u32 i, struct umount_cost *out)
+{
+	int cpu;
+
+	*out = plan->carried[i];
+	if (!plan->costs)
 		return;
+
+	for_each_possible_cpu (cpu) {
+		struct umount_cost *c = per_cpu_ptr(plan->costs, cpu) + i;
+
+		out->calls += READ_ONCE(c->calls);
+		out->total_ns += READ_ONCE(c->total_ns);
+		out->max_ns = max_t(u64, out->max_ns, READ_ONCE(c->max_ns));
+	}
+}
+
+// per entry stats survive list changes, n*m but only once per generation
+static void umount_plan_carry_stats(struct umount_plan *plan, struct umount_plan *old)
+{
+	u32 i, j;
+
+	for (i = 0; i < plan->count; i++) {
+		struct umount_target *t = &plan->targets[i];
+
+		for (j = 0; j < old->count; j++) {
+			struct umount_target *o = &old->targets[j];
+
+			if (o->hash != t->hash || strcmp(o->path, t->path))
+				continue;
+
+			umount_plan_cost(old, j, &plan->carried[i]);
+			break;
+		}
+	}
+}
+
+static struct umount_plan *umount_plan_build(struct umount_plan *old)
+{
+	struct umount_plan *plan = NULL;
+	struct mount_entry *entry;
+	size_t bytes = 0;
+	u32 count = 0;
+	char *str;
+
+	down_read(&mount_list_lock);
+	list_for_each_entry (entry, &mount_list, list) {
+		bytes += strlen(entry->umountable) + 1;
+		count++;
+	}
+
+	plan = kvmalloc(struct_size(plan, targets, count) + bytes, GFP_KERNEL);
+	if (!plan)
+		goto out;
+
+	plan->carried = kvmalloc(max_t(u32, count, 1) * sizeof(struct umount_cost), GFP_KERNEL);
+	if (!plan->carried) {
+		kvfree(plan);
+		plan = NULL;
+		goto out;
+	}
+	memset(plan->carried, 0, max_t(u32, count, 1) * sizeof(struct umount_cost));
+
+	// per cpu chunks are small, a huge list just goes without stats
+	plan->costs = __alloc_percpu(max_t(u32, count, 1) * sizeof(struct umount_cost),
+				     __alignof__(struct umount_cost));
+	plan->gen = mount_list_gen;
+	plan->count = count;
+
+	str = (char *)&plan->targets[count];
+	count = 0;
+	list_for_each_entry (entry, &mount_list, list) {
+		size_t len = strlen(entry->umountable) + 1;
+
+		memcpy(str, entry->umountable, len);
+		plan->targets[count].path = str;
+		plan->targets[count].flags = entry->flags;
+		plan->targets[count].hash = entry->hash;
+		str += len;
+		count++;
+	}
+
+out:
+	up_read(&mount_list_lock);
+
+	if (plan && old)
+		umount_plan_carry_stats(plan, old);
+	return plan;
+}
+
+/*
+ * the plan for the current list, NULL on oom
+ * must be called inside a umount_plan_srcu read section, the plan stays
+ * valid until it is left. a stale plan is replaced here, the old one is
+ * freed once every reader that may still use it is gone
+ */
+static struct umount_plan *umount_plan_get(void)
+{
+	struct umount_plan *plan, *old;
+
+	plan = srcu_dereference(ksu_umount_plan, &umount_plan_srcu);
+	if (likely(plan && plan->gen == READ_ONCE(mount_list_gen)))
+		return plan;
+
+	mutex_lock(&umount_plan_mutex);
+	old = rcu_dereference_protected(ksu_umount_plan, lockdep_is_held(&umount_plan_mutex));
+	// another fork already rebuilt it
+	if (old && old->gen == READ_ONCE(mount_list_gen)) {
+		mutex_unlock(&umount_plan_mutex);
+		return old;
 	}
 
-	ksu_umount_mnt(mnt, &path, flags);
+	plan = umount_plan_build(old);
+	if (!plan) {
+		mutex_unlock(&umount_plan_mutex);
+		return NULL;
+	}
+
+	rcu_assign_pointer(ksu_umount_plan, plan);
+	mutex_unlock(&umount_plan_mutex);
+
+	if (old)
+		call_srcu(&umount_plan_srcu, &old->rcu, umount_plan_free_rcu);
+
+	return plan;
+}
+
+/*
+ * mount namespaces already stripped with a given mount_list_gen, a process
+ * landing in one of them again has nothing left to umount.
+ * keyed by ns_common->ns_id, which is never handed out twice, so no slot
+ * pins its namespace. before that only the proc inode number exists, and it
+ * is recycled together with the namespace memory as soon as one dies, so
+ * older kernels always do the full walk.
+ * lookups are lockless, the seqlock only orders them against marks
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 18, 0)
+#define KSU_CLEAN_NS_SLOTS 16
+
+struct clean_ns {
+	u64 id;
+	unsigned long gen;
+};
+
+static struct clean_ns ksu_clean_ns[KSU_CLEAN_NS_SLOTS];
+static unsigned int ksu_clean_ns_next = 0;
+static DEFINE_SEQLOCK(clean_ns_lock);
+
+// id of the mount namespace current lives in, 0 if unknown
+static u64 ksu_current_mnt_ns_id(void)
+{
+	struct ns_common *ns = mntns_operations.get(current);
+	u64 id;
+
+	if (!ns)
+		return 0;
+
+	id = ns->ns_id;
+	// current keeps it alive, this is never the last put
+	mntns_operations.put(ns);
+	return id;
 }
 
+static bool clean_ns_test(u64 id, unsigned long gen)
+{
+	unsigned int seq, i;
+	bool clean;
+
+	do {
+		seq = read_seqbegin(&clean_ns_lock);
+		clean = false;
+		for (i = 0; i < KSU_CLEAN_NS_SLOTS; i++) {
+			if (ksu_clean_ns[i].id == id) {
+				clean = ksu_clean_ns[i].gen == gen;
+				break;
+			}
+		}
+	} while (read_seqretry(&clean_ns_lock, seq));
+
+	return clean;
+}
+
+static void clean_ns_mark(u64 id, unsigned long gen)
+{
+	struct clean_ns *slot = NULL;
+	unsigned int i;
+
+	write_seqlock(&clean_ns_lock);
+	for (i = 0; i < KSU_CLEAN_NS_SLOTS; i++) {
+		if (ksu_clean_ns[i].id == id) {
+			slot = &ksu_clean_ns[i];
+			break;
+		}
+	}
+	if (!slot) {
+		slot = &ksu_clean_ns[ksu_clean_ns_next];
+		ksu_clean_ns_next = (ksu_clean_ns_next + 1) % KSU_CLEAN_NS_SLOTS;
+	}
+	slot->id = id;
+	slot->gen = gen;
+	write_sequnlock(&clean_ns_lock);
+}
+#else
+static inline u64 ksu_current_mnt_ns_id(void)
+{
+	return 0;
+}
+
+static inline bool clean_ns_test(u64 id, unsigned long gen)
+{
+	return false;
+}
+
+static inline void clean_ns_mark(u64 id, unsigned long gen)
+{
+}
+#endif
+
 static inline int ksu_handle_umount(struct cred *new, const struct cred *old)
 {
 	uid_t new_uid = ksu_get_uid_t(new->uid);
 	uid_t old_uid = ksu_get_uid_t(old->uid);
+	struct umount_plan *plan;
+	const struct cred *saved;
+	u64 ns_id;
+	u32 i, done = 0, failed = 0;
+	u64 start, t0, cost;
+	int ret, idx;
 
 	if (!ksu_kernel_umount_enabled)
 		return 0;
@@ -81,24 +404,147 @@ static inline int ksu_handle_umount(struct cred *new, const struct cred *old)
 		pr_info("handle umount ignore non zygote child: %d\n", current->pid);
 		return 0;
 	}
-	// umount the target mnt
-	pr_info("handle umount for uid: %d, pid: %d\n", new_uid, current->pid);
 
-	const struct cred *saved = override_creds(ksu_cred);
+	start = ktime_get_ns();
+	idx = srcu_read_lock(&umount_plan_srcu);
+	plan = umount_plan_get();
+	ns_id = ksu_current_mnt_ns_id();
 
-	struct mount_entry *entry;
-	down_read(&mount_list_lock);
-	list_for_each_entry (entry, &mount_list, list) {
-		pr_info("%s: unmounting: %s flags: 0x%x\n", __func__, entry->umountable, entry->flags);
-		try_umount(entry->umountable, entry->flags);
+	if (ns_id && plan && clean_ns_test(ns_id, plan->gen)) {
+		ksu_umount_ns_skipped++;
+		i = 0;
+		goto out;
+	}
+
+	saved = override_creds(ksu_cred);
+
+	// umount the target mnt
+	if (likely(plan)) {
+		for (i = 0; i < plan->count; i++) {
+			t0 = ktime_get_ns();
+			ret = try_umount(plan->targets[i].path, plan->targets[i].flags);
+			cost = ktime_get_ns() - t0;
+			umount_target_account(plan, i, cost);
+			this_cpu_inc(ksu_umount_hist.entry[umount_hist_bucket(cost)]);
+			if (ret > 0)
+				done++;
+			else if (ret < 0)
+				failed++;
+		}
+	} else {
+		// no memory for a plan, walk the list under the lock like before
+		struct mount_entry *entry;
+
+		i = 0;
+		down_read(&mount_list_lock);
+		list_for_each_entry (entry, &mount_list, list) {
+			t0 = ktime_get_ns();
+			ret = try_umount(entry->umountable, entry->flags);
+			this_cpu_inc(ksu_umount_hist.entry[umount_hist_bucket(ktime_get_ns() - t0)]);
+			if (ret > 0)
+				done++;
+			else if (ret < 0)
+				failed++;
+			i++;
+		}
+		up_read(&mount_list_lock);
 	}
-	up_read(&mount_list_lock);
 
 	revert_creds(saved);
 
+	ksu_umount_performed += done;
+	ksu_umount_failed += failed;
+	ksu_umount_not_mounted += i - done - failed;
+
+	// whatever failed is still mounted, so only a fully stripped ns counts as clean
+	if (ns_id && plan && !failed)
+		clean_ns_mark(ns_id, plan->gen);
+
+out:
+	srcu_read_unlock(&umount_plan_srcu, idx);
+
+	this_cpu_inc(ksu_umount_hist.call[umount_hist_bucket(ktime_get_ns() - start)]);
+
+	if (IS_ENABLED(CONFIG_KSU_DEBUG))
+		pr_info("handle umount for uid: %d, pid: %d, %u entries, %u umounted, %u failed\n",
+			new_uid, current->pid, i, done, failed);
+
 	return 0;
 }
 
+void ksu_umount_stats_read(struct ksu_umount_stats_cmd *cmd)
+{
+	u64 totals[KSU_UMOUNT_TOP_MAX];
+	struct umount_plan *plan;
+	struct umount_cost c;
+	u32 i, j, n = 0;
+	int cpu, idx;
+
+	for_each_possible_cpu (cpu) {
+		struct umount_hist *h = per_cpu_ptr(&ksu_umount_hist, cpu);
+
+		for (i = 0; i < KSU_UMOUNT_HIST_BUCKETS; i++) {
+			cmd->call_hist[i] += READ_ONCE(h->call[i]);
+			cmd->entry_hist[i] += READ_ONCE(h->entry[i]);
+		}
+	}
+
+	idx = srcu_read_lock(&umount_plan_srcu);
+	plan = umount_plan_get();
+	if (!plan)
+		goto out;
+
+	// insertion into the short top array, kept sorted by total cost
+	for (i = 0; i < plan->count; i++) {
+		struct umount_target *t = &plan->targets[i];
+		u64 total;
+
+		umount_plan_cost(plan, i, &c);
+		total = c.total_ns;
+		if (!c.calls)
+			continue;
+		if (n == KSU_UMOUNT_TOP_MAX && total <= totals[n - 1])
+			continue;
+
+		j = n < KSU_UMOUNT_TOP_MAX ? n++ : n - 1;
+		for (; j > 0 && totals[j - 1] < total; j--) {
+			totals[j] = totals[j - 1];
+			cmd->top[j] = cmd->top[j - 1];
+		}
+
+		totals[j] = total;
+		strscpy_pad(cmd->top[j].path, t->path, sizeof(cmd->top[j].path));
+		cmd->top[j].total_ns = total;
+		cmd->top[j].max_ns = c.max_ns;
+		cmd->top[j].calls = c.calls;
+		cmd->top[j].flags = t->flags;
+	}
+	cmd->top_count = n;
+out:
+	srcu_read_unlock(&umount_plan_srcu, idx);
+}
+
+// racing increments may survive a reset, good enough for a profile
+void ksu_umount_stats_reset(void)
+{
+	struct umount_plan *plan;
+	int cpu, idx;
+
+	for_each_possible_cpu (cpu)
+		memset(per_cpu_ptr(&ksu_umount_hist, cpu), 0, sizeof(struct umount_hist));
+
+	idx = srcu_read_lock(&umount_plan_srcu);
+	plan = umount_plan_get();
+	if (plan) {
+		memset(plan->carried, 0, max_t(u32, plan->count, 1) * sizeof(struct umount_cost));
+		if (plan->costs) {
+			for_each_possible_cpu (cpu)
+				memset(per_cpu_ptr(plan->costs, cpu), 0, plan->count * sizeof(struct umount_cost));
+		}
+	}
+	srcu_read_unlock(&umount_plan_srcu, idx);
+}
+
 void __init ksu_kernel_umount_init(void)
 {
 	if (ksu_register_feature_handler(&kernel_umount_handler)) {
@@ -108,5 +554,18 @@ void __init ksu_kernel_umount_init(void)
 
 void __exit ksu_kernel_umount_exit(void)
 {
+	struct umount_plan *plan;
+
 	ksu_unregister_feature_handler(KSU_FEATURE_KERNEL_UMOUNT);
+
+	mutex_lock(&umount_plan_mutex);
+	plan = rcu_dereference_protected(ksu_umount_plan, lockdep_is_held(&umount_plan_mutex));
+	RCU_INIT_POINTER(ksu_umount_plan, NULL);
+	mutex_unlock(&umount_plan_mutex);
+
+	synchronize_srcu(&umount_plan_srcu);
+	if (plan)
+		umount_plan_free(plan);
+	// plans replaced earlier may still be queued
+	srcu_barrier(&umount_plan_srcu);
 }
@@ -3,11 +3,19 @@
 
 // for the umount list
 struct mount_entry {
-    char *umountable;
+    struct list_head list; // umount order, newest first
+    struct hlist_node node; // mount_hash, keyed by path
+    u32 hash;
     unsigned int flags;
-    struct list_head list;
+    char umountable[];
 };
 extern struct list_head mount_list;
 extern struct rw_semaphore mount_list_lock;
+// bumped under mount_list_lock on every change, see umount_plan_get
+extern unsigned long mount_list_gen;
+
+// latency histograms and the most expensive entries, for KSU_IOCTL_UMOUNT_STATS
+void ksu_umount_stats_read(struct ksu_umount_stats_cmd *cmd);
+void ksu_umount_stats_reset(void);
 
 #endif
@@ -64,52 +64,258 @@ void ksu_slow_avc_audit(u32 *tsid)
 	return;
 }
 
-static bool ksu_should_destroy_context(char *str)
+/*
+ * precompiled hide list, published under rcu so lookups never take the mutex
+ *
+ * an entry ":name:" of the packed lists matches when some field between two
+ * colons of the string equals name, so the string is split on ':' once and
+ * every field is looked up in a hash of all names. types hide on their own,
+ * rules need src in any field and tgt in a field after the first space,
+ * checked as (src id, tgt id) pairs in a second hash
+ */
+#define KSU_HIDE_MAX_FIELDS 64 // callers pass at most 128 bytes
+
+struct hide_name_slot {
+	u32 hash;
+	u32 off; // into blob
+	u16 len; // 0 = empty slot
+	u16 id;
+	bool type;
+};
+
+struct hide_matcher {
+	struct rcu_head rcu;
+	unsigned long gen; // ksu_hide_list_gen it was built from
+	u32 name_mask;
+	u32 pair_mask;
+	u32 nr_names;
+	u32 nr_pairs;
+	u32 blob_len;
+	struct hide_name_slot *names;
+	u32 *pairs; // (src << 16 | tgt) + 1, 0 = empty slot
+	char *blob;
+};
+
+static struct hide_matcher __rcu *ksu_hide_matcher = NULL;
+
+static const struct hide_name_slot *hide_matcher_find(const struct hide_matcher *m, const char *name, u32 len)
 {
-	if (!str)
-		return false;
+	u32 hash = jhash(name, len, 0);
+	u32 i;
 
-	bool status = false;
+	for (i = hash & m->name_mask;; i = (i + 1) & m->name_mask) {
+		const struct hide_name_slot *slot = &m->names[i];
 
-	mutex_lock(&selinux_hide_list_mutex);
+		if (!slot->len)
+			return NULL;
+		if (slot->hash == hash && slot->len == len && !memcmp(m->blob + slot->off, name, len))
+			return slot;
+	}
+}
 
-	size_t offset = 0;
-	while (offset < ksu_hide_type_len) {
-		const char *current_entry = ksu_hide_type_list + offset;
-		
-		if (strstr(str, current_entry)) {
-			status = true;
-			goto out_unlock;
-		}
+// slot of name, added if missing, NULL once the u16 ids run out
+static struct hide_name_slot *hide_matcher_intern(struct hide_matcher *m, const char *name, u32 len)
+{
+	u32 hash = jhash(name, len, 0);
+	struct hide_name_slot *slot;
+	u32 i;
+
+	for (i = hash & m->name_mask;; i = (i + 1) & m->name_mask) {
+		slot = &m->names[i];
+		if (!slot->len)
+			break;
+		if (slot->hash == hash && slot->len == len && !memcmp(m->blob + slot->off, name, len))
+			return slot;
+	}
+
+	if (m->nr_names >= U16_MAX)
+		return NULL;
+
+	memcpy(m->blob + m->blob_len, name, len);
+	slot->hash = hash;
+	slot->off = m->blob_len;
+	slot->len = len;
+	slot->id = m->nr_names++;
+	m->blob_len += len;
+	return slot;
+}
+
+static bool hide_matcher_has_pair(const struct hide_matcher *m, u16 src, u16 tgt)
+{
+	u32 key = ((u32)src << 16 | tgt) + 1;
+	u32 i;
 
-		offset = offset + strlen(current_entry) + 1;
+	for (i = hash_32(key, 32) & m->pair_mask; m->pairs[i]; i = (i + 1) & m->pair_mask) {
+		if (m->pairs[i] == key)
+			return true;
 	}
+	return false;
+}
 
-	// double strstr
-	char *str2 = strchr(str, ' ');
-	if (!str2)
-		goto out_unlock;
+static void hide_matcher_add_pair(struct hide_matcher *m, u16 src, u16 tgt)
+{
+	u32 key = ((u32)src << 16 | tgt) + 1;
+	u32 i;
 
-	offset = 0;
-	while (offset < ksu_hide_rule_len) {
+	for (i = hash_32(key, 32) & m->pair_mask; m->pairs[i]; i = (i + 1) & m->pair_mask) {
+		if (m->pairs[i] == key)
+			return;
+	}
+	m->pairs[i] = key;
+	m->nr_pairs++;
+}
+
+// packed entries are ":name:", strip the colons
+static struct hide_name_slot *hide_matcher_intern_entry(struct hide_matcher *m, const char *entry, size_t entry_len)
+{
+	if (entry_len <= 2)
+		return NULL;
+	return hide_matcher_intern(m, entry + 1, entry_len - 2);
+}
+
+// selinux_hide_list_mutex held
+static struct hide_matcher *hide_matcher_build(void)
+{
+	struct hide_matcher *m;
+	struct hide_name_slot *slot, *tgt;
+	size_t nr_types = 0, nr_rules = 0, offset, len, size;
+	u32 name_slots, pair_slots;
+
+	for (offset = 0; offset < ksu_hide_type_len; offset += strlen(ksu_hide_type_list + offset) + 1)
+		nr_types++;
+	for (offset = 0; offset < ksu_hide_rule_len; nr_rules++) {
+		offset += strlen(ksu_hide_rule_list + offset) + 1;
+		offset += strlen(ksu_hide_rule_list + offset) + 1;
+	}
+
+	// at most half full, so probes stay short and always end
+	name_slots = roundup_pow_of_two(max_t(size_t, 2 * (nr_types + 2 * nr_rules), 16));
+	pair_slots = roundup_pow_of_two(max_t(size_t, 2 * nr_rules, 16));
+
+	size = sizeof(*m) + name_slots * sizeof(*m->names) + pair_slots * sizeof(*m->pairs) + ksu_hide_type_len +
+	       ksu_hide_rule_len;
+	m = kvmalloc(size, GFP_KERNEL);
+	if (!m)
+		return NULL;
+	memset(m, 0, size);
+
+	m->gen = ksu_hide_list_gen;
+	m->name_mask = name_slots - 1;
+	m->pair_mask = pair_slots - 1;
+	m->names = (struct hide_name_slot *)(m + 1);
+	m->pairs = (u32 *)(m->names + name_slots);
+	m->blob = (char *)(m->pairs + pair_slots);
+
+	for (offset = 0; offset < ksu_hide_type_len; offset += len + 1) {
+		len = strlen(ksu_hide_type_list + offset);
+		slot = hide_matcher_intern_entry(m, ksu_hide_type_list + offset, len);
+		if (slot)
+			slot->type = true;
+	}
+
+	for (offset = 0; offset < ksu_hide_rule_len;) {
 		const char *src_rule = ksu_hide_rule_list + offset;
-		size_t src_sz = strlen(src_rule) + 1;
-			
-		const char *tgt_rule = src_rule + src_sz;
-		size_t tgt_sz = strlen(tgt_rule) + 1;
-
-		if (strstr(str, src_rule) && strstr(str2, tgt_rule)) {
-			status = true;
-			goto out_unlock;
-		}
+		size_t src_len = strlen(src_rule);
+		const char *tgt_rule = src_rule + src_len + 1;
+		size_t tgt_len = strlen(tgt_rule);
+
+		offset += src_len + 1 + tgt_len + 1;
 
-		offset = offset + src_sz + tgt_sz;
+		slot = hide_matcher_intern_entry(m, src_rule, src_len);
+		tgt = hide_matcher_intern_entry(m, tgt_rule, tgt_len);
+		if (slot && tgt)
+			hide_matcher_add_pair(m, slot->id, tgt->id);
 	}
 
+	pr_info("selinux_hide: matcher built, %u names, %u rules\n", m->nr_names, m->nr_pairs);
+	return m;
+}
+
+static void hide_matcher_free_rcu(struct rcu_head *head)
+{
+	kvfree(container_of(head, struct hide_matcher, rcu));
+}
+
+static void ksu_hide_matcher_rebuild(void)
+{
+	struct hide_matcher *m, *old;
+
+	mutex_lock(&selinux_hide_list_mutex);
+
+	old = rcu_dereference_protected(ksu_hide_matcher, lockdep_is_held(&selinux_hide_list_mutex));
+	// raced with another rebuild
+	if (old && old->gen == ksu_hide_list_gen)
+		goto out_unlock;
+
+	m = hide_matcher_build();
+	if (!m)
+		goto out_unlock;
+
+	rcu_assign_pointer(ksu_hide_matcher, m);
+	if (old)
+		call_rcu(&old->rcu, hide_matcher_free_rcu);
+
 out_unlock:
 	mutex_unlock(&selinux_hide_list_mutex);
-	return status;
+}
 
+static bool hide_matcher_match(const struct hide_matcher *m, const char *str)
+{
+	const char *space = strchr(str, ' ');
+	u16 srcs[KSU_HIDE_MAX_FIELDS], tgts[KSU_HIDE_MAX_FIELDS];
+	u32 nr_srcs = 0, nr_tgts = 0, i, j;
+	const char *p, *q;
+
+	for (p = strchr(str, ':'); p; p = q) {
+		const struct hide_name_slot *slot;
+
+		q = strchr(p + 1, ':');
+		if (!q)
+			break;
+
+		slot = hide_matcher_find(m, p + 1, q - p - 1);
+		if (!slot)
+			continue;
+		if (slot->type)
+			return true;
+
+		if (nr_srcs < KSU_HIDE_MAX_FIELDS)
+			srcs[nr_srcs++] = slot->id;
+		if (space && p > space && nr_tgts < KSU_HIDE_MAX_FIELDS)
+			tgts[nr_tgts++] = slot->id;
+	}
+
+	for (i = 0; i < nr_tgts; i++) {
+		for (j = 0; j < nr_srcs; j++) {
+			if (hide_matcher_has_pair(m, srcs[j], tgts[i]))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+static bool ksu_should_destroy_context(char *str)
+{
+	struct hide_matcher *m;
+	bool status;
+
+	if (!str)
+		return false;
+
+	rcu_read_lock();
+	m = rcu_dereference(ksu_hide_matcher);
+	if (unlikely(!m || m->gen != READ_ONCE(ksu_hide_list_gen))) {
+		// the list grew, both callers may sleep
+		rcu_read_unlock();
+		ksu_hide_matcher_rebuild();
+		rcu_read_lock();
+		m = rcu_dereference(ksu_hide_matcher);
+	}
+	status = m && hide_matcher_match(m, str);
+	rcu_read_unlock();
+
+	return status;
 }
 
 #if 0
@@ -33,6 +33,9 @@ static size_t ksu_hide_rule_len = 0;
 
 static DEFINE_MUTEX(selinux_hide_list_mutex);
 
+// bumped on every new entry, the matcher in selinux_hide.c is rebuilt on mismatch
+static unsigned long ksu_hide_list_gen = 0;
+
 static void ksu_add_shit_to_list(u32 cmd, const char *args[])
 {
 	if (!args || !args[0])
@@ -78,6 +81,7 @@ static void ksu_add_shit_to_list(u32 cmd, const char *args[])
 		sprintf(w_ptr, ":%s:", name);
 
 		ksu_hide_type_len = new_total_len;
+		WRITE_ONCE(ksu_hide_list_gen, ksu_hide_list_gen + 1);
 
 		pr_info("selinux_hide: tracking type: %s\n", w_ptr );
 
@@ -132,6 +136,7 @@ static void ksu_add_shit_to_list(u32 cmd, const char *args[])
 		sprintf(w_ptr_tgt, ":%s:", tgt);
 
 		ksu_hide_rule_len = new_total_len;
+		WRITE_ONCE(ksu_hide_list_gen, ksu_hide_list_gen + 1);
 
 		pr_info("selinux_hide: tracking rule: %s %s\n", w_ptr_src, w_ptr_tgt);
 
@@ -10,6 +10,8 @@
 #define KSU_SEPOLICY_CMD_TYPE_TRANSITION 7
 #define KSU_SEPOLICY_CMD_TYPE_CHANGE 8
 #define KSU_SEPOLICY_CMD_GENFSCON 9
+/* NORMAL_PERM with a set per argument, v2 batches only */
+#define KSU_SEPOLICY_CMD_NORMAL_PERM_SET 10
 
 #define KSU_SEPOLICY_SUBCMD_NORMAL_PERM_ALLOW 1
 #define KSU_SEPOLICY_SUBCMD_NORMAL_PERM_DENY 2
@@ -7,6 +7,8 @@
 /* Magic numbers for reboot hook to install fd */
 #define KSU_INSTALL_MAGIC1 0xDEADBEEF
 #define KSU_INSTALL_MAGIC2 0xCAFEBABE
+// reboot(MAGIC1, QUERY_FD, 0, &fd): fd is set to the caller's lowest [ksu_driver] fd, or -1
+#define KSU_QUERY_FD_MAGIC2 0xCAFEF00D
 
 struct ksu_become_daemon_cmd {
 	__u8 token[65]; /* Input: daemon token (null-terminated) */
@@ -38,11 +40,48 @@ struct ksu_report_event_cmd {
 	__u32 event; /* Input: EVENT_POST_FS_DATA, EVENT_BOOT_COMPLETED, etc. */
 };
 
+/*
+ * >= 5.10 applies a batch to a policy copy and swaps it in at once.
+ * Older kernels apply it in place, in chunks of up to 64 commands with the
+ * policy readable in between, so a batch is not atomic there: lookups may
+ * see part of it, and a malformed command leaves the chunks before it applied.
+ */
 struct ksu_set_sepolicy_cmd {
 	__u64 data_len; /* Input: bytes of serialized command payload */
 	__aligned_u64 data; /* Input: pointer to serialized payload */
 };
 
+/*
+ * SET_SEPOLICY plus a per command outcome
+ * results[i] gets one KSU_SEPOLICY_RESULT_* for command i (0 if never reached),
+ * a batch with no APPLIED command leaves the live policy and the avc alone
+ */
+struct ksu_set_sepolicy_ex_cmd {
+	__u64 data_len; /* Input: bytes of serialized command payload */
+	__aligned_u64 data; /* Input: pointer to serialized payload */
+	__aligned_u64 results; /* Output: pointer to results_len bytes */
+	__u32 results_len; /* Input: size of results, one byte per command */
+	__u32 reserved; /* Input: must be 0 */
+};
+
+#define KSU_SEPOLICY_RESULT_APPLIED 1 /* policy changed */
+#define KSU_SEPOLICY_RESULT_NOOP 2 /* rule / type was already there */
+#define KSU_SEPOLICY_RESULT_FAILED 3
+
+/*
+ * while a transaction is open, SET_SEPOLICY calls of the same process go into
+ * a private policy copy, commit makes them live at once
+ * commit returns the number of applied commands, -EAGAIN if the policy was
+ * replaced meanwhile (nothing applied then)
+ */
+struct ksu_sepolicy_txn_cmd {
+	__u32 op; /* Input: KSU_SEPOLICY_TXN_* */
+};
+
+#define KSU_SEPOLICY_TXN_BEGIN 1
+#define KSU_SEPOLICY_TXN_COMMIT 2
+#define KSU_SEPOLICY_TXN_ABORT 3
+
 struct ksu_sepolicy_cmd_hdr {
 	__u32 cmd; /* Input: command type, CMD_* */
 	__u32 subcmd; /* Input: command subtype */
@@ -59,6 +98,24 @@ struct ksu_sepolicy_cmd_hdr {
  * KSU_SEPOLICY_CMD_GENFSCON=3.
  */
 
+/*
+ * v2 batch, same commands with every distinct argument sent once:
+ * [u32 KSU_SEPOLICY_V2_MAGIC][u32 nr_strings]
+ * nr_strings * ([u32 len][len bytes][\0]), len > 0
+ * then per command a ksu_sepolicy_cmd_hdr and argc * [u16 string index],
+ * KSU_SEPOLICY_V2_ALL stands for ALL.
+ * KSU_SEPOLICY_CMD_NORMAL_PERM_SET takes a set for each of its 4 arguments
+ * instead, [u16 count][count * u16 string index], a set holding ALL is ALL.
+ * Accepted by SET_SEPOLICY and SET_SEPOLICY_EX, older kernels reject it as a
+ * bad first command (-EINVAL) without applying anything.
+ * A bare header with no strings and no commands is a probe, kernels with v2
+ * answer it with 0 and leave the policy alone. -EINVAL on a real v2 batch
+ * does not mean v2 is missing, pre-5.10 may have applied the chunks before
+ * the bad command.
+ */
+#define KSU_SEPOLICY_V2_MAGIC 0x32504553 /* "SEP2" */
+#define KSU_SEPOLICY_V2_ALL 0xffff
+
 struct ksu_check_safemode_cmd {
 	__u8 in_safe_mode; /* Output: true if in safe mode, false otherwise */
 };
@@ -139,10 +196,136 @@ struct ksu_get_sulog_fd_cmd {
 	__u32 flags; /* Input: reserved for future use, must be 0 */
 };
 
+/*
+ * signature verdict for one apk, computed by ksud
+ * ino/size/mtime are what ksud saw on the file it hashed, the kernel drops
+ * the entry if its own stat disagrees
+ */
+struct ksu_apk_verdict {
+	__aligned_u64 path; /* Input: char ptr, absolute path of base.apk */
+	__u64 ino; /* Input: st_ino */
+	__s64 size; /* Input: st_size */
+	__s64 mtime_sec; /* Input: st_mtime */
+	__u32 mtime_nsec; /* Input: st_mtime_nsec */
+	__u32 cert_size; /* Input: v2 signer certificate length */
+	__u8 cert_sha256[65]; /* Input: lowercase hex sha256 of the certificate (null-terminated) */
+};
+
+struct ksu_submit_apk_verdicts_cmd {
+	__aligned_u64 entries; /* Input: pointer to struct ksu_apk_verdict array */
+	__u32 count; /* Input: number of entries, at most KSU_APK_VERDICTS_MAX */
+	__u32 accepted; /* Output: entries taken into the verdict cache */
+};
+
+#define KSU_APK_VERDICTS_MAX 1024
+
 #define KSU_UMOUNT_WIPE 0	// ignore everything and wipe list
 #define KSU_UMOUNT_ADD 1	// add entry (path + flags)
 #define KSU_UMOUNT_DEL 2	// delete entry, strcmp
 
+struct ksu_try_umount_entry {
+	__aligned_u64 path; /* Input: char ptr, the mountpoint */
+	__u32 flags; /* Input: umount flags, ignored for KSU_UMOUNT_DEL */
+	__s32 result; /* Output: 0, -EEXIST, -ENOENT or another -errno for this entry */
+};
+
+struct ksu_try_umount_batch_cmd {
+	__aligned_u64 entries; /* Input: pointer to struct ksu_try_umount_entry array */
+	__u32 count; /* Input: number of entries, at most KSU_TRY_UMOUNT_BATCH_MAX */
+	__u32 mode; /* Input: KSU_UMOUNT_ADD or KSU_UMOUNT_DEL */
+	__u32 done; /* Output: entries added or removed */
+	__u32 reserved; /* must be 0 */
+};
+
+#define KSU_TRY_UMOUNT_BATCH_MAX 1024
+
+/*
+ * GET_TRY_UMOUNT_LIST fills buf with count headers followed by the paths,
+ * offset is from the start of buf. entries come in umount order
+ */
+struct ksu_try_umount_list_entry {
+	__u32 offset; /* Output: offset of the null-terminated path */
+	__u32 flags; /* Output: umount flags */
+};
+
+struct ksu_get_try_umount_list_cmd {
+	__aligned_u64 buf; /* Input: output buffer */
+	__u32 buf_size; /* Input: size of buf, nothing is copied if it is too small */
+	__u32 count; /* Output: number of headers written */
+	__u32 total_size; /* Output: bytes needed for the whole list */
+	__u32 reserved; /* must be 0 */
+};
+
+#define KSU_UMOUNT_STATS_GET 0
+#define KSU_UMOUNT_STATS_RESET 1
+
+#define KSU_UMOUNT_HIST_BUCKETS 32
+#define KSU_UMOUNT_TOP_MAX 16
+
+struct ksu_umount_top_entry {
+	char path[256]; /* Output: mountpoint */
+	__u64 total_ns; /* Output: path walk plus umount, summed over all calls */
+	__u64 max_ns; /* Output: slowest single call */
+	__u32 calls; /* Output: times this entry was tried */
+	__u32 flags; /* Output: umount flags */
+};
+
+/*
+ * histogram bucket i counts calls that took [2^i, 2^(i+1)) ns, the last one
+ * also everything slower. top is sorted by total_ns, most expensive first
+ */
+struct ksu_umount_stats_cmd {
+	__u32 op; /* Input: KSU_UMOUNT_STATS_GET or KSU_UMOUNT_STATS_RESET */
+	__u32 top_count; /* Output: entries filled in top */
+	__u64 call_hist[KSU_UMOUNT_HIST_BUCKETS]; /* Output: whole umount pass per zygote child */
+	__u64 entry_hist[KSU_UMOUNT_HIST_BUCKETS]; /* Output: single entry, path walk plus umount */
+	struct ksu_umount_top_entry top[KSU_UMOUNT_TOP_MAX]; /* Output */
+};
+
+/*
+ * BATCH runs up to KSU_IOCTL_BATCH_MAX supercalls in order, each with its own
+ * permission check. result is the return value of that command, -ENOTTY or
+ * -EPERM if it was not run, -ECANCELED if an earlier one stopped the batch
+ */
+struct ksu_ioctl_batch_entry {
+	__u32 cmd; /* Input: KSU_IOCTL_* command, BATCH itself is rejected */
+	__s32 result; /* Output */
+	__aligned_u64 arg; /* Input: argument of that command */
+};
+
+struct ksu_ioctl_batch_cmd {
+	__aligned_u64 entries; /* Input: pointer to struct ksu_ioctl_batch_entry array */
+	__u32 count; /* Input: number of entries */
+	__u32 flags; /* Input: KSU_IOCTL_BATCH_* */
+};
+
+#define KSU_IOCTL_BATCH_MAX 64
+#define KSU_IOCTL_BATCH_STOP_ON_ERROR (1 << 0)
+
+/*
+ * FD_HOLDERS lists every process holding a KernelSU anon fd, one entry per
+ * process and kind. count is capped by buf_count, total is the real number
+ */
+struct ksu_fd_holder {
+	__u32 pid; /* tgid of the holder */
+	__s32 fd; /* lowest fd of this kind in that process */
+	__u32 kind; /* KSU_FD_KIND_* */
+	__u32 creator; /* tgid that created the file at fd */
+};
+
+struct ksu_get_fd_holders_cmd {
+	__aligned_u64 buf; /* Input: struct ksu_fd_holder array */
+	__u32 buf_count; /* Input: capacity of buf in entries */
+	__u32 count; /* Output: entries written */
+	__u32 total; /* Output: entries found */
+	__u32 live; /* Output: tracked files still open, 0 means nothing to look for */
+};
+
+#define KSU_FD_KIND_DRIVER 1 /* [ksu_driver] */
+#define KSU_FD_KIND_SULOG 2 /* [ksu_sulog] */
+#define KSU_FD_KIND_WRAPPER 3 /* [ksu_fdwrapper] */
+#define KSU_FD_HOLDERS_MAX 4096
+
 // IOCTL command definitions
 #define KSU_IOCTL_GRANT_ROOT _IOC(_IOC_NONE, 'K', 1, 0)
 #define KSU_IOCTL_GET_INFO _IOR('K', 2, struct ksu_get_info_cmd)
@@ -170,5 +353,13 @@ struct ksu_get_sulog_fd_cmd {
 #define KSU_IOCTL_SET_INIT_PGRP _IO('K', 19)
 #define KSU_IOCTL_GET_SULOG_FD _IOW('K', 20, struct ksu_get_sulog_fd_cmd)
 #define KSU_IOCTL_DISABLE_ESCAPE_TO_ROOT _IO('K', 21)
+#define KSU_IOCTL_SUBMIT_APK_VERDICTS _IOWR('K', 22, struct ksu_submit_apk_verdicts_cmd)
+#define KSU_IOCTL_SEPOLICY_TXN _IOW('K', 23, struct ksu_sepolicy_txn_cmd)
+#define KSU_IOCTL_SET_SEPOLICY_EX _IOWR('K', 24, struct ksu_set_sepolicy_ex_cmd)
+#define KSU_IOCTL_TRY_UMOUNT_BATCH _IOWR('K', 25, struct ksu_try_umount_batch_cmd)
+#define KSU_IOCTL_GET_TRY_UMOUNT_LIST _IOWR('K', 26, struct ksu_get_try_umount_list_cmd)
+#define KSU_IOCTL_UMOUNT_STATS _IOWR('K', 27, struct ksu_umount_stats_cmd)
+#define KSU_IOCTL_BATCH _IOW('K', 28, struct ksu_ioctl_batch_cmd)
+#define KSU_IOCTL_GET_FD_HOLDERS _IOWR('K', 29, struct ksu_get_fd_holders_cmd)
 
 #endif
@@ -0,0 +1,158 @@
+/*
+ * every anon file we hand out ([ksu_driver], [ksu_sulog], [ksu_fdwrapper])
+ * is recorded here from just before fd_install until its ->release, so the
+ * table holds exactly the files that are still open somewhere.
+ *
+ * the creating pid alone is not enough to answer "who holds it": fds survive
+ * fork, get dup'd and passed over binder / SCM_RIGHTS. so holders are found by
+ * one in-kernel walk over every fd table, matching against this set, instead
+ * of userspace readlinking /proc/<pid>/fd/* for the whole system.
+ */
+struct ksu_tracked_fd {
+	struct hlist_node node;
+	struct rcu_head rcu;
+	struct file *file;
+	u32 kind;
+	pid_t creator;
+};
+
+static DEFINE_HASHTABLE(ksu_fd_table, 6);
+static DEFINE_SPINLOCK(ksu_fd_table_lock);
+static u32 ksu_fd_live;
+
+struct ksu_tracked_fd *ksu_fd_track_prepare(void)
+{
+	return kzalloc(sizeof(struct ksu_tracked_fd), GFP_KERNEL);
+}
+
+void ksu_fd_track_commit(struct ksu_tracked_fd *t, struct file *file, u32 kind)
+{
+	t->file = file;
+	t->kind = kind;
+	t->creator = task_tgid_nr(current);
+
+	spin_lock(&ksu_fd_table_lock);
+	hash_add_rcu(ksu_fd_table, &t->node, (unsigned long)file);
+	WRITE_ONCE(ksu_fd_live, ksu_fd_live + 1);
+	spin_unlock(&ksu_fd_table_lock);
+}
+
+void ksu_fd_track_abort(struct ksu_tracked_fd *t)
+{
+	kfree(t);
+}
+
+void ksu_fd_untrack(struct file *file)
+{
+	struct ksu_tracked_fd *t;
+
+	spin_lock(&ksu_fd_table_lock);
+	hash_for_each_possible (ksu_fd_table, t, node, (unsigned long)file) {
+		if (t->file != file)
+			continue;
+
+		hash_del_rcu(&t->node);
+		WRITE_ONCE(ksu_fd_live, ksu_fd_live - 1);
+		spin_unlock(&ksu_fd_table_lock);
+		kfree_rcu(t, rcu);
+		return;
+	}
+	spin_unlock(&ksu_fd_table_lock);
+}
+
+struct ksu_fd_holders_ctx {
+	// indexed by kind, .kind != 0 once seen in the current task
+	struct ksu_fd_holder found[KSU_FD_KIND_WRAPPER + 1];
+};
+
+// runs under rcu_read_lock and files->file_lock, must not sleep
+static int ksu_fd_holders_match(const void *p, struct file *file, unsigned int fd)
+{
+	struct ksu_fd_holders_ctx *ctx = (struct ksu_fd_holders_ctx *)p;
+	struct ksu_tracked_fd *t;
+
+	hash_for_each_possible_rcu (ksu_fd_table, t, node, (unsigned long)file) {
+		if (t->file != file)
+			continue;
+
+		// fds come in ascending order, keep the first one per kind
+		if (!ctx->found[t->kind].kind) {
+			ctx->found[t->kind].fd = fd;
+			ctx->found[t->kind].kind = t->kind;
+			ctx->found[t->kind].creator = t->creator;
+		}
+		break;
+	}
+
+	// never stop iterate_fd early, a process can hold several kinds
+	return 0;
+}
+
+/*
+ * fills up to max entries, one per (process, kind), returns how many were
+ * written. *total is the number found, *live the number of tracked files.
+ * processes are walked by pid like /proc readdir, so each one is pinned and
+ * looked at on its own and no rcu section spans the whole task list
+ */
+u32 ksu_fd_holders_collect(struct ksu_fd_holder *out, u32 max, u32 *total, u32 *live)
+{
+	struct ksu_fd_holders_ctx ctx;
+	struct task_struct *p;
+	struct pid *pid;
+	int nr;
+	u32 n = 0;
+	u32 kind;
+
+	*total = 0;
+	*live = READ_ONCE(ksu_fd_live);
+	// nothing open, no need to look at a single fd table
+	if (!*live)
+		return 0;
+
+	for (nr = 1;; nr++) {
+		rcu_read_lock();
+		pid = find_ge_pid(nr, &init_pid_ns);
+		if (!pid) {
+			rcu_read_unlock();
+			break;
+		}
+		nr = pid_nr(pid);
+
+		// threads share the leader's fd table in practice, same set as for_each_process
+		p = pid_task(pid, PIDTYPE_PID);
+		if (!p || !thread_group_leader(p) || (p->flags & PF_KTHREAD)) {
+			rcu_read_unlock();
+			continue;
+		}
+		get_task_struct(p);
+		rcu_read_unlock();
+
+		memset(&ctx, 0, sizeof(ctx));
+
+		// same pattern as __do_SAK, task_lock keeps ->files alive
+		task_lock(p);
+		if (p->files) {
+			rcu_read_lock(); // for the tracked table
+			iterate_fd(p->files, 0, ksu_fd_holders_match, &ctx);
+			rcu_read_unlock();
+		}
+		task_unlock(p);
+
+		for (kind = KSU_FD_KIND_DRIVER; kind <= KSU_FD_KIND_WRAPPER; kind++) {
+			if (!ctx.found[kind].kind)
+				continue;
+
+			if (n < max) {
+				out[n] = ctx.found[kind];
+				out[n].pid = nr;
+				n++;
+			}
+			(*total)++;
+		}
+
+		put_task_struct(p);
+		cond_resched();
+	}
+
+	return n;
+}
@@ -0,0 +1,15 @@
+#ifndef __KSU_H_FD_HOLDERS
+#define __KSU_H_FD_HOLDERS
+
+struct ksu_tracked_fd;
+
+// prepare before the file exists so commit cannot fail once it does
+struct ksu_tracked_fd *ksu_fd_track_prepare(void);
+void ksu_fd_track_commit(struct ksu_tracked_fd *t, struct file *file, u32 kind);
+void ksu_fd_track_abort(struct ksu_tracked_fd *t);
+// call from ->release
+void ksu_fd_untrack(struct file *file);
+
+u32 ksu_fd_holders_collect(struct ksu_fd_holder *out, u32 max, u32 *total, u32 *live);
+
+#endif
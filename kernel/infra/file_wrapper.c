@@ -324,6 +324,8 @@ static int ksu_wrapper_fadvise(struct file *fp, loff_t off1, loff_t off2, int fl
 static void ksu_release_file_wrapper(struct ksu_file_wrapper *data);
 
 static int ksu_wrapper_release(struct inode *inode, struct file *filp) {
+	ksu_fd_untrack(filp);
+
 	// https://cs.android.com/android/kernel/superproject/+/common-android-mainline:common/fs/file_table.c;l=467-473;drc=3be0b283b562eabbc2b1f3bb534dc8903079bbaa
 	// f_op->release is called before fops_put(f_op), so we put it manually.
 	fops_put(filp->f_op);
@@ -441,6 +443,7 @@ static const struct dentry_operations ksu_file_wrapper_d_ops = {
 int ksu_install_file_wrapper(int fd)
 {
 	int out_fd, ret;
+	struct ksu_tracked_fd *t = NULL;
 	struct file *orig_file = fget(fd);
 	if (!orig_file) {
 		return -EBADF;
@@ -452,6 +455,12 @@ int ksu_install_file_wrapper(int fd)
 		goto done;
 	}
 
+	t = ksu_fd_track_prepare();
+	if (!t) {
+		ret = -ENOMEM;
+		goto out_put_fd;
+	}
+
 	struct ksu_file_wrapper *file_wrapper_data =
 		ksu_create_file_wrapper(orig_file);
 	if (IS_ERR(file_wrapper_data)) {
@@ -495,6 +504,7 @@ int ksu_install_file_wrapper(int fd)
 	wrapper_file->f_path.dentry->d_fsdata = orig_path;
 	wrapper_file->f_path.dentry->d_op = &ksu_file_wrapper_d_ops;
 
+	ksu_fd_track_commit(t, wrapper_file, KSU_FD_KIND_WRAPPER);
 	fd_install(out_fd, wrapper_file);
 	ret = out_fd;
 	goto done;
@@ -506,6 +516,7 @@ out_put_wrapper_file:
 out_release_wrapper:
 	ksu_release_file_wrapper(file_wrapper_data);
 out_put_fd:
+	ksu_fd_track_abort(t);
 	put_unused_fd(out_fd);
 done:
 	fput(orig_file);
@@ -34,19 +34,114 @@ static long ksu_sys_setns(int fd, int flags)
 #define ksys_unshare sys_unshare
 #endif // > 4.17
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
+/*
+ * init's mount namespace file, opened once and reopened only when init
+ * switched namespaces (bootstrap -> default). the file pins the namespace,
+ * so comparing ns pointers against it is safe.
+ */
+static struct file *init_mnt_ns_file = NULL;
+static DEFINE_MUTEX(init_mnt_ns_mutex);
+
+static struct file *ksu_get_init_mnt_ns_file(void)
+{
+	struct file *file = ERR_PTR(-ESRCH), *old = NULL;
+	struct task_struct *pid1_task;
+	struct ns_common *ns;
+	struct path ns_path;
+	long ret;
+
+	rcu_read_lock();
+	// &init_task is not init, but swapper/idle, which forks the init process
+	// so we need find init process
+	struct pid *pid_struct = find_pid_ns(1, &init_pid_ns);
+	pid1_task = pid_struct ? get_pid_task(pid_struct, PIDTYPE_PID) : NULL;
+	rcu_read_unlock();
+	if (unlikely(!pid1_task)) {
+		pr_warn("failed to get task_struct for PID 1\n");
+		return file;
+	}
+
+	ns = mntns_operations.get(pid1_task);
+	if (unlikely(!ns))
+		goto out_task;
+
+	mutex_lock(&init_mnt_ns_mutex);
+	if (likely(init_mnt_ns_file && get_proc_ns(file_inode(init_mnt_ns_file)) == ns)) {
+		file = get_file(init_mnt_ns_file);
+		goto out_unlock;
+	}
+
+	ret = (long)ns_get_path(&ns_path, pid1_task, &mntns_operations);
+	if (ret) {
+		pr_warn("failed get path for init mount namespace: %ld\n", ret);
+		file = ERR_PTR(ret);
+		goto out_unlock;
+	}
+
+	file = dentry_open(&ns_path, O_RDONLY, ksu_cred);
+	path_put(&ns_path);
+	if (IS_ERR(file)) {
+		pr_warn("failed open file for init mount namespace: %ld\n", PTR_ERR(file));
+		goto out_unlock;
+	}
+
+	old = init_mnt_ns_file;
+	init_mnt_ns_file = get_file(file);
+	pr_info("init mount namespace cached\n");
+
+out_unlock:
+	mutex_unlock(&init_mnt_ns_mutex);
+	mntns_operations.put(ns);
+	if (old)
+		fput(old);
+out_task:
+	put_task_struct(pid1_task);
+	return file;
+}
+
+// the cached file pins init's mount namespace
+void ksu_mount_ns_exit(void)
+{
+	struct file *file;
+
+	mutex_lock(&init_mnt_ns_mutex);
+	file = init_mnt_ns_file;
+	init_mnt_ns_file = NULL;
+	mutex_unlock(&init_mnt_ns_mutex);
+
+	if (file)
+		fput(file);
+}
+#else
+void ksu_mount_ns_exit(void) { }
+#endif
+
 // global mode , need CAP_SYS_ADMIN and CAP_SYS_CHROOT to perform setns
 static void ksu_mnt_ns_global(void)
 {
 	// save current working directory as absolute path before setns
 	char *pwd_path = NULL;
-	char *pwd_buf = kmalloc(PATH_MAX, GFP_KERNEL);
+	char *pwd_buf = NULL;
+	struct path saved_pwd, saved_root;
+
+	get_fs_root(current->fs, &saved_root);
+	get_fs_pwd(current->fs, &saved_pwd);
+	// setns puts us at the root of the new namespace anyway
+	if (path_equal(&saved_pwd, &saved_root)) {
+		path_put(&saved_pwd);
+		path_put(&saved_root);
+		goto try_setns;
+	}
+	path_put(&saved_root);
+
+	pwd_buf = __getname();
 	if (!pwd_buf) {
+		path_put(&saved_pwd);
 		pr_warn("no mem for pwd buffer, skip restore pwd!!\n");
 		goto try_setns;
 	}
 
-	struct path saved_pwd;
-	get_fs_pwd(current->fs, &saved_pwd);
 	pwd_path = d_path(&saved_pwd, pwd_buf, PATH_MAX);
 	path_put(&saved_pwd);
 
@@ -62,30 +157,11 @@ static void ksu_mnt_ns_global(void)
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
 try_setns:
-
-	rcu_read_lock();
-	// &init_task is not init, but swapper/idle, which forks the init process
-	// so we need find init process
-	struct pid *pid_struct = find_pid_ns(1, &init_pid_ns);
-	if (unlikely(!pid_struct)) {
-		rcu_read_unlock();
-		pr_warn("failed to find pid_struct for PID 1\n");
-		goto out;
-	}
-
-	struct task_struct *pid1_task = get_pid_task(pid_struct, PIDTYPE_PID);
-	rcu_read_unlock();
-	if (unlikely(!pid1_task)) {
-		pr_warn("failed to get task_struct for PID 1\n");
-		goto out;
-	}
-	struct path ns_path;
-	long ret = (long)ns_get_path(&ns_path, pid1_task, &mntns_operations);
-	put_task_struct(pid1_task);
-	if (ret) {
-		pr_warn("failed get path for init mount namespace: %ld\n", ret);
+	;
+	long ret;
+	struct file *ns_file = ksu_get_init_mnt_ns_file();
+	if (IS_ERR(ns_file))
 		goto out;
-	}
 #else
 try_setns:
 	;
@@ -103,7 +179,6 @@ try_setns:
 		goto out;
 	}
 	revert_creds(saved);
-#endif
 
 	struct file *ns_file = dentry_open(&ns_path, O_RDONLY, ksu_cred);
 
@@ -113,6 +188,7 @@ try_setns:
 				PTR_ERR(ns_file));
 		goto out;
 	}
+#endif
 
 	int fd = get_unused_fd_flags(O_CLOEXEC);
 	if (fd < 0) {
@@ -142,7 +218,8 @@ try_setns:
 		}
 	}
 out:
-	kfree(pwd_buf);
+	if (pwd_buf)
+		__putname(pwd_buf);
 }
 
 // individual mode , need CAP_SYS_ADMIN to perform unshare and remount
@@ -6,5 +6,6 @@
 #define KSU_NS_INDIVIDUAL 2
 
 void setup_mount_ns(int32_t ns_mode);
+void ksu_mount_ns_exit(void);
 
 #endif
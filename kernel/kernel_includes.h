@@ -27,10 +27,12 @@
 #include <linux/fs.h>
 #include <linux/fs_struct.h>
 #include <linux/gfp.h>
+#include <linux/hash.h>
 #include <linux/init.h>
 #include <linux/init_task.h>
 #include <linux/input.h>
 #include <linux/ioctl.h>
+#include <linux/jhash.h>
 #include <linux/jump_label.h>
 #include <linux/kernel.h>
 #include <linux/kobject.h>
@@ -48,6 +50,7 @@
 #include <linux/namei.h>
 #include <linux/nsproxy.h>
 #include <linux/path.h>
+#include <linux/percpu.h>
 #include <linux/pid.h>
 #include <linux/poll.h>
 #include <linux/printk.h>
@@ -59,7 +62,10 @@
 #include <linux/seccomp.h>
 #include <linux/security.h>
 #include <linux/seq_file.h>
+#include <linux/seqlock.h>
 #include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/srcu.h>
 #include <linux/stddef.h>
 #include <linux/string.h>
 #include <linux/syscalls.h>
@@ -36,6 +36,7 @@
 #include "infra/su_mount_ns.h"
 #include "infra/file_wrapper.h"
 #include "infra/event_queue.h"
+#include "infra/fd_holders.h"
 #include "feature/adb_root.h"
 #include "feature/kernel_umount.h"
 #include "feature/selinux_hide.h"
@@ -72,6 +73,7 @@
 #include "infra/su_mount_ns.c"
 #include "infra/file_wrapper.c"
 #include "infra/event_queue.c"
+#include "infra/fd_holders.c"
 
 #include "feature/adb_root.c"
 #include "feature/kernel_umount.c"
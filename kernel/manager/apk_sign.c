@@ -33,71 +33,158 @@ static int calc_hash(struct crypto_shash *alg, const unsigned char *data,
 	return ret;
 }
 
+// allocated once and shared, only the per-call sdesc holds hash state
+static struct crypto_shash *ksu_sha256_tfm = NULL;
+static DEFINE_MUTEX(ksu_sha256_mutex);
+
 static int ksu_sha256(const unsigned char *data, unsigned int datalen,
 		      unsigned char *digest)
 {
-	struct crypto_shash *alg;
 	char *hash_alg_name = "sha256";
-	int ret;
 
-	alg = crypto_alloc_shash(hash_alg_name, 0, 0);
-	if (IS_ERR(alg)) {
-		pr_info("can't alloc alg %s\n", hash_alg_name);
-		return PTR_ERR(alg);
+	mutex_lock(&ksu_sha256_mutex);
+	if (!ksu_sha256_tfm) {
+		struct crypto_shash *alg = crypto_alloc_shash(hash_alg_name, 0, 0);
+		if (IS_ERR(alg)) {
+			mutex_unlock(&ksu_sha256_mutex);
+			pr_info("can't alloc alg %s\n", hash_alg_name);
+			return PTR_ERR(alg);
+		}
+		ksu_sha256_tfm = alg;
 	}
-	ret = calc_hash(alg, data, datalen, digest);
-	crypto_free_shash(alg);
-	return ret;
+	mutex_unlock(&ksu_sha256_mutex);
+
+	return calc_hash(ksu_sha256_tfm, data, datalen, digest);
+}
+
+static void ksu_sha256_free(void)
+{
+	mutex_lock(&ksu_sha256_mutex);
+	if (ksu_sha256_tfm) {
+		crypto_free_shash(ksu_sha256_tfm);
+		ksu_sha256_tfm = NULL;
+	}
+	mutex_unlock(&ksu_sha256_mutex);
+}
+
+// the block is a byte stream, fields are not aligned
+static inline u32 get_le32(const u8 *p)
+{
+	__le32 v;
+	memcpy(&v, p, sizeof(v));
+	return le32_to_cpu(v);
 }
 
-static bool check_block(struct file *fp, u32 *size4, loff_t *pos, u32 *offset,
-			unsigned expected_size, const char *expected_sha256)
+static inline u64 get_le64(const u8 *p)
 {
-	kernel_read(fp, size4, 0x4, pos); // signer-sequence length
-	kernel_read(fp, size4, 0x4, pos); // signer length
-	kernel_read(fp, size4, 0x4, pos); // signed data length
+	__le64 v;
+	memcpy(&v, p, sizeof(v));
+	return le64_to_cpu(v);
+}
 
-	*offset += 0x4 * 3;
+/*
+ * v2 signature scheme block value, already in memory
+ * https://source.android.com/docs/security/features/apksigning/v2#apk-signature-scheme-v2-block-format
+ */
+static bool check_block(const u8 *value, u64 len, unsigned expected_size,
+			const char *expected_sha256)
+{
+	u64 off = 0;
+	u32 size4;
 
-	kernel_read(fp, size4, 0x4, pos); // digests-sequence length
+#define TAKE_LE32(out)						\
+	do {							\
+		if (len - off < 4)				\
+			return false;				\
+		(out) = get_le32(value + off);			\
+		off += 4;					\
+	} while (0)
 
-	*pos += *size4;
-	*offset += 0x4 + *size4;
+	TAKE_LE32(size4); // signer-sequence length
+	TAKE_LE32(size4); // signer length
+	TAKE_LE32(size4); // signed data length
+	TAKE_LE32(size4); // digests-sequence length
 
-	kernel_read(fp, size4, 0x4, pos); // certificates length
-	kernel_read(fp, size4, 0x4, pos); // certificate length
-	*offset += 0x4 * 2;
+	if (len - off < size4)
+		return false;
+	off += size4;
 
-	if (*size4 == expected_size) {
-		*offset += *size4;
+	TAKE_LE32(size4); // certificates length
+	TAKE_LE32(size4); // certificate length
+#undef TAKE_LE32
+
+	if (size4 != expected_size)
+		return false;
 
 #define CERT_MAX_LENGTH 2373
-		char *cert __attribute__((__cleanup__(ksu_kfree_byref))) = kzalloc(CERT_MAX_LENGTH, GFP_KERNEL);
-		if (!cert)
-			return false;
+	if (size4 > CERT_MAX_LENGTH) {
+		pr_info("cert length overlimit\n");
+		return false;
+	}
 
-		if (*size4 > CERT_MAX_LENGTH) {
-			pr_info("cert length overlimit\n");
-			return false;
-		}
-		kernel_read(fp, cert, *size4, pos);
-		unsigned char digest[SHA256_DIGEST_SIZE];
-		if (ksu_sha256(cert, *size4, digest) < 0 ) {
-			pr_info("sha256 error\n");
-			return false;
-		}
+	if (len - off < size4)
+		return false;
 
-		char hash_str[SHA256_DIGEST_SIZE * 2 + 1];
-		hash_str[SHA256_DIGEST_SIZE * 2] = '\0';
+	unsigned char digest[SHA256_DIGEST_SIZE];
+	if (ksu_sha256(value + off, size4, digest) < 0) {
+		pr_info("sha256 error\n");
+		return false;
+	}
 
-		bin2hex(hash_str, digest, SHA256_DIGEST_SIZE);
-		pr_info("sha256: %s, expected: %s\n", hash_str,
-			expected_sha256);
-		if (strcmp(expected_sha256, hash_str) == 0) {
-			return true;
-		}
+	char hash_str[SHA256_DIGEST_SIZE * 2 + 1];
+	hash_str[SHA256_DIGEST_SIZE * 2] = '\0';
+
+	bin2hex(hash_str, digest, SHA256_DIGEST_SIZE);
+	pr_info("sha256: %s, expected: %s\n", hash_str,
+		expected_sha256);
+	return strcmp(expected_sha256, hash_str) == 0;
+}
+
+#define EOCD_SIZE 22
+#define EOCD_MAGIC 0x06054b50u
+#define ZIP_MAX_COMMENT 0xffff
+// way bigger than any real signing block, keeps a bogus size from allocating the world
+#define APK_SIG_BLOCK_MAX (1 << 20)
+
+/*
+ * read the tail of the file once and scan it backwards for the eocd
+ * https://en.wikipedia.org/wiki/Zip_(file_format)#End_of_central_directory_record_(EOCD)
+ */
+static int find_central_directory(struct file *fp, u32 *cd_offset)
+{
+	loff_t size = i_size_read(file_inode(fp));
+	size_t len = min_t(loff_t, size, ZIP_MAX_COMMENT + EOCD_SIZE);
+	loff_t pos = size - len;
+	int ret = -ENOENT;
+	size_t i;
+
+	if (len < EOCD_SIZE)
+		return -EINVAL;
+
+	u8 *buf = kvmalloc(len, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	if (kernel_read(fp, buf, len, &pos) != len) {
+		ret = -EIO;
+		goto out;
 	}
-	return false;
+
+	for (i = 0; i <= ZIP_MAX_COMMENT && i + EOCD_SIZE <= len; i++) {
+		const u8 *eocd = buf + len - EOCD_SIZE - i;
+		if ((eocd[20] | (eocd[21] << 8)) != i)
+			continue;
+		if (get_le32(eocd) != EOCD_MAGIC)
+			continue;
+
+		*cd_offset = get_le32(eocd + 16);
+		ret = 0;
+		break;
+	}
+
+out:
+	kvfree(buf);
+	return ret;
 }
 
 struct zip_entry_header {
@@ -153,12 +240,16 @@ static bool has_v1_signature_file(struct file *fp)
 	return false;
 }
 
+/*
+ * transient is set when the apk could not be inspected right now
+ * (locked or unopenable), such a verdict must not be cached
+ */
 static __always_inline bool check_v2_signature(char *path,
 					       unsigned expected_size,
-					       const char *expected_sha256)
+					       const char *expected_sha256,
+					       bool *transient)
 {
-	unsigned char buffer[0x11] = { 0 };
-	u32 size4;
+	u8 *block = NULL;
 	u64 size8, size_of_block;
 
 	loff_t pos;
@@ -168,11 +259,11 @@ static __always_inline bool check_v2_signature(char *path,
 	bool v3_signing_exist = false;
 	bool v3_1_signing_exist = false;
 
-	int i;
-
 	struct path kpath;
-	if (kern_path(path, 0, &kpath))
+	if (kern_path(path, 0, &kpath)) {
+		*transient = true;
 		return false;
+	}
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 5, 0) 
 	if (inode_is_locked(kpath.dentry->d_inode))
@@ -182,6 +273,7 @@ static __always_inline bool check_v2_signature(char *path,
 	{
 		pr_info("%s: inode is locked for %s\n", __func__, path);
 		path_put(&kpath);
+		*transient = true;
 		return false;
 	}
 
@@ -190,61 +282,63 @@ static __always_inline bool check_v2_signature(char *path,
 	struct file *fp = filp_open(path, O_RDONLY, 0);
 	if (IS_ERR(fp)) {
 		// pr_err("open %s error.\n", path);
+		*transient = true;
 		return false;
 	}
 
 	// disable inotify for this file
 	fp->f_mode |= FMODE_NONOTIFY;
 
-	// https://en.wikipedia.org/wiki/Zip_(file_format)#End_of_central_directory_record_(EOCD)
-	for (i = 0;; ++i) {
-		unsigned short n;
-		pos = vfs_llseek(fp, -i - 2, SEEK_END);
-		kernel_read(fp, &n, 2, &pos);
-		if (n == i) {
-			pos -= 22;
-			kernel_read(fp, &size4, 4, &pos);
-			if ((size4 ^ 0xcafebabeu) == 0xccfbf1eeu) {
-				break;
-			}
-		}
-		if (i == 0xffff) {
-			pr_info("error: cannot find eocd\n");
-			goto clean;
-		}
+	u32 cd_offset;
+	if (find_central_directory(fp, &cd_offset)) {
+		pr_info("error: cannot find eocd\n");
+		goto clean;
 	}
 
-	pos += 12;
-	// offset
-	kernel_read(fp, &size4, 0x4, &pos);
-	pos = size4 - 0x18;
+	// [u64 size][...pairs...][u64 size]["APK Sig Block 42"][central directory]
+	u8 footer[0x18];
+	if (cd_offset < sizeof(footer))
+		goto clean;
 
-	kernel_read(fp, &size8, 0x8, &pos);
-	kernel_read(fp, buffer, 0x10, &pos);
-	if (memcmp(buffer, "APK Sig Block 42", 16)) {
+	pos = cd_offset - sizeof(footer);
+	if (kernel_read(fp, footer, sizeof(footer), &pos) != sizeof(footer))
 		goto clean;
-	}
 
-	pos = size4 - (size8 + 0x8);
-	kernel_read(fp, &size_of_block, 0x8, &pos);
-	if (size_of_block != size8) {
+	if (memcmp(footer + 8, "APK Sig Block 42", 16))
+		goto clean;
+
+	size8 = get_le64(footer);
+	if (size8 < sizeof(footer) || size8 > APK_SIG_BLOCK_MAX || size8 + 8 > cd_offset)
 		goto clean;
-	}
 
+	// whole block in one read, size field included
+	block = kvmalloc(size8 + 8, GFP_KERNEL);
+	if (!block)
+		goto clean;
+
+	pos = cd_offset - (size8 + 8);
+	if (kernel_read(fp, block, size8 + 8, &pos) != size8 + 8)
+		goto clean;
+
+	size_of_block = get_le64(block);
+	if (size_of_block != size8)
+		goto clean;
+
+	// pairs live between the leading size and the footer
+	u64 off = 8;
+	u64 end = size8 + 8 - sizeof(footer);
 	int loop_count = 0;
-	while (loop_count++ < 10) {
-		uint32_t id;
-		uint32_t offset;
-		kernel_read(fp, &size8, 0x8, &pos); // sequence length
-		if (size8 == size_of_block) {
+	while (loop_count++ < 10 && end - off >= 12) {
+		u64 pair_len = get_le64(block + off); // sequence length
+		u32 id = get_le32(block + off + 8); // id
+
+		if (pair_len < 4 || pair_len > end - off - 8)
 			break;
-		}
-		kernel_read(fp, &id, 0x4, &pos); // id
-		offset = 4;
+
 		if (id == 0x7109871au) {
 			v2_signing_blocks++;
 			v2_signing_valid =
-				check_block(fp, &size4, &pos, &offset,
+				check_block(block + off + 12, pair_len - 4,
 					    expected_size, expected_sha256);
 		} else if (id == 0xf05368c0u) {
 			// http://aospxref.com/android-14.0.0_r2/xref/frameworks/base/core/java/android/util/apk/ApkSignatureSchemeV3Verifier.java#73
@@ -257,7 +351,7 @@ static __always_inline bool check_v2_signature(char *path,
 			pr_info("Unknown id: 0x%08x\n", id);
 #endif
 		}
-		pos += (size8 - offset);
+		off += 8 + pair_len;
 	}
 
 	if (v2_signing_blocks != 1) {
@@ -272,11 +366,12 @@ static __always_inline bool check_v2_signature(char *path,
 		int has_v1_signing = has_v1_signature_file(fp);
 		if (has_v1_signing) {
 			pr_err("Unexpected v1 signature scheme found!\n");
-			filp_close(fp, 0);
-			return false;
+			v2_signing_valid = false;
 		}
 	}
 clean:
+	if (block)
+		kvfree(block);
 	filp_close(fp, 0);
 
 	if (v3_signing_exist || v3_1_signing_exist) {
@@ -350,6 +445,178 @@ int get_pkg_from_apk_path(char *pkg, const char *path)
 	return 0;
 }
 
+/*
+ * verdict cache for is_manager_apk
+ * keyed by what changes when an apk is replaced or touched in place,
+ * so repeated /data/app scans skip signature parsing for known apks
+ * there is only one expected signature, so the verdict is a plain bool
+ */
+struct apk_verdict {
+	struct hlist_node node;
+	dev_t dev;
+	u64 ino;
+	loff_t size;
+	s64 mtime_sec;
+	long mtime_nsec;
+	s64 ctime_sec;
+	long ctime_nsec;
+	bool is_manager;
+};
+
+#define APK_VERDICT_BITS 6
+#define APK_VERDICT_MAX 1024
+
+static DEFINE_HASHTABLE(apk_verdict_cache, APK_VERDICT_BITS);
+static DEFINE_MUTEX(apk_verdict_mutex);
+static unsigned int apk_verdict_count = 0;
+static unsigned int apk_verdict_hits = 0;
+static unsigned int apk_verdict_misses = 0;
+
+static int apk_verdict_key(const char *path, struct apk_verdict *key)
+{
+	struct path kpath;
+	struct kstat stat;
+	int err;
+
+	err = kern_path(path, 0, &kpath);
+	if (err)
+		return err;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+	err = vfs_getattr(&kpath, &stat, STATX_BASIC_STATS, AT_STATX_SYNC_AS_STAT);
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(3, 9, 0)
+	err = vfs_getattr(&kpath, &stat);
+#else
+	err = vfs_getattr(kpath.mnt, kpath.dentry, &stat);
+#endif
+	path_put(&kpath);
+	if (err)
+		return err;
+
+	key->dev = stat.dev;
+	key->ino = stat.ino;
+	key->size = stat.size;
+	key->mtime_sec = stat.mtime.tv_sec;
+	key->mtime_nsec = stat.mtime.tv_nsec;
+	key->ctime_sec = stat.ctime.tv_sec;
+	key->ctime_nsec = stat.ctime.tv_nsec;
+	return 0;
+}
+
+static bool apk_verdict_match(const struct apk_verdict *a, const struct apk_verdict *b)
+{
+	return a->dev == b->dev && a->ino == b->ino && a->size == b->size &&
+	       a->mtime_sec == b->mtime_sec && a->mtime_nsec == b->mtime_nsec &&
+	       a->ctime_sec == b->ctime_sec && a->ctime_nsec == b->ctime_nsec;
+}
+
+static void apk_verdict_flush(void)
+{
+	struct apk_verdict *np;
+	struct hlist_node *tmp;
+	int i;
+
+	hash_for_each_safe (apk_verdict_cache, i, tmp, np, node) {
+		hash_del(&np->node);
+		kfree(np);
+	}
+	apk_verdict_count = 0;
+}
+
+// returns 1 for manager, 0 for not manager, -ENOENT on miss
+static int apk_verdict_lookup(const struct apk_verdict *key)
+{
+	struct apk_verdict *np;
+	int ret = -ENOENT;
+
+	mutex_lock(&apk_verdict_mutex);
+	hash_for_each_possible (apk_verdict_cache, np, node, key->ino) {
+		if (apk_verdict_match(np, key)) {
+			ret = np->is_manager;
+			break;
+		}
+	}
+	if (ret < 0)
+		apk_verdict_misses++;
+	else
+		apk_verdict_hits++;
+	mutex_unlock(&apk_verdict_mutex);
+	return ret;
+}
+
+static void apk_verdict_store(const struct apk_verdict *key, bool is_manager)
+{
+	struct apk_verdict *np = kmalloc(sizeof(*np), GFP_KERNEL);
+	if (!np)
+		return;
+
+	*np = *key;
+	np->is_manager = is_manager;
+
+	mutex_lock(&apk_verdict_mutex);
+	// stale entries of replaced apks pile up over time, start over
+	if (apk_verdict_count >= APK_VERDICT_MAX)
+		apk_verdict_flush();
+	hash_add(apk_verdict_cache, &np->node, np->ino);
+	apk_verdict_count++;
+	mutex_unlock(&apk_verdict_mutex);
+}
+
+static bool apk_verdict_cached(const struct apk_verdict *key)
+{
+	struct apk_verdict *np;
+	bool found = false;
+
+	mutex_lock(&apk_verdict_mutex);
+	hash_for_each_possible (apk_verdict_cache, np, node, key->ino) {
+		if (apk_verdict_match(np, key)) {
+			found = true;
+			break;
+		}
+	}
+	mutex_unlock(&apk_verdict_mutex);
+	return found;
+}
+
+/*
+ * take a signature verdict computed by ksud
+ * the cert is matched against our own expected signature here, ksud only
+ * saves us the parsing. a match is never cached, is_manager_apk verifies
+ * the manager apk itself, so only "not the manager" is ever trusted
+ * returns 0 if cached, 1 if it matched and is left to the kernel, < 0 if dropped
+ */
+int ksu_apk_submit_verdict(const char *path, const struct ksu_apk_verdict *v)
+{
+	struct apk_verdict key;
+	int err;
+
+	err = apk_verdict_key(path, &key);
+	if (err)
+		return err;
+
+	// file changed between ksud hashing it and now
+	if (key.ino != v->ino || key.size != v->size ||
+	    key.mtime_sec != v->mtime_sec || key.mtime_nsec != v->mtime_nsec)
+		return -ESTALE;
+
+	if (v->cert_size == EXPECTED_SIZE &&
+	    !strncmp((const char *)v->cert_sha256, EXPECTED_HASH, sizeof(v->cert_sha256)))
+		return 1;
+
+	if (!apk_verdict_cached(&key))
+		apk_verdict_store(&key, false);
+
+	return 0;
+}
+
+void ksu_apk_verdict_stats(unsigned int *hits, unsigned int *misses)
+{
+	mutex_lock(&apk_verdict_mutex);
+	*hits = apk_verdict_hits;
+	*misses = apk_verdict_misses;
+	mutex_unlock(&apk_verdict_mutex);
+}
+
 bool is_manager_apk(char *path)
 {
 #ifdef KSU_MANAGER_PACKAGE
@@ -364,5 +631,24 @@ bool is_manager_apk(char *path)
 		return false;
 	}
 #endif
-	return check_v2_signature(path, EXPECTED_SIZE, EXPECTED_HASH);
+	struct apk_verdict key;
+	bool cacheable = !apk_verdict_key(path, &key);
+	if (cacheable) {
+		int verdict = apk_verdict_lookup(&key);
+		if (verdict >= 0)
+			return verdict;
+	}
+
+	bool transient = false;
+	bool is_manager = check_v2_signature(path, EXPECTED_SIZE, EXPECTED_HASH, &transient);
+	if (cacheable && !transient)
+		apk_verdict_store(&key, is_manager);
+
+	return is_manager;
+}
+
+// after the tracker is stopped, nothing hashes apks anymore
+void ksu_apk_sign_exit(void)
+{
+	ksu_sha256_free();
 }
@@ -3,5 +3,8 @@
 
 bool is_manager_apk(char *path);
 int get_pkg_from_apk_path(char *pkg, const char *path);
+void ksu_apk_verdict_stats(unsigned int *hits, unsigned int *misses);
+int ksu_apk_submit_verdict(const char *path, const struct ksu_apk_verdict *v);
+void ksu_apk_sign_exit(void);
 
 #endif
@@ -3,12 +3,157 @@ uid_t ksu_manager_appid = KSU_INVALID_APPID;
 #define SYSTEM_PACKAGES_LIST_PATH "/data/system/packages.list"
 
 struct uid_data {
-	struct list_head list;
+	struct hlist_node node;
 	u32 uid;
-	char package[KSU_MAX_PACKAGE_NAME];
+	char *package;
+};
+
+#define UID_MAP_BITS 9
+#define UID_MAP_INITIAL_CAPACITY 256
+
+/*
+ * parsed packages.list
+ * entries[] is sorted by (uid, package) in uid_map_build(), table indexes them by uid
+ * table is only valid after uid_map_build(), entries[] may move before that
+ * hash is FNV-1a over the raw file content
+ */
+struct uid_map {
+	DECLARE_HASHTABLE(table, UID_MAP_BITS);
+	struct uid_data *entries;
+	size_t count;
+	size_t capacity;
+	u64 hash;
 };
 
-static __always_inline void crown_manager(const char *apk, struct list_head *uid_data)
+#define FNV1A64_OFFSET 0xcbf29ce484222325ULL
+#define FNV1A64_PRIME 0x100000001b3ULL
+
+static u64 fnv1a64(u64 hash, const char *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (u8)buf[i];
+		hash *= FNV1A64_PRIME;
+	}
+	return hash;
+}
+
+static int uid_map_append(struct uid_map *map, u32 uid, const char *package)
+{
+	if (map->count == map->capacity) {
+		size_t capacity = map->capacity ? map->capacity * 2 : UID_MAP_INITIAL_CAPACITY;
+		struct uid_data *entries = kvmalloc(capacity * sizeof(*entries), GFP_KERNEL);
+		if (!entries)
+			return -ENOMEM;
+
+		if (map->entries) {
+			memcpy(entries, map->entries, map->count * sizeof(*entries));
+			kvfree(map->entries);
+		}
+		map->entries = entries;
+		map->capacity = capacity;
+	}
+
+	struct uid_data *data = &map->entries[map->count];
+	data->package = kstrndup(package, KSU_MAX_PACKAGE_NAME - 1, GFP_KERNEL);
+	if (!data->package)
+		return -ENOMEM;
+
+	data->uid = uid;
+	map->count++;
+	return 0;
+}
+
+static int uid_data_cmp(const void *a, const void *b)
+{
+	const struct uid_data *l = a;
+	const struct uid_data *r = b;
+
+	if (l->uid != r->uid)
+		return l->uid < r->uid ? -1 : 1;
+	return strcmp(l->package, r->package);
+}
+
+static void uid_map_build(struct uid_map *map)
+{
+	size_t i;
+
+	sort(map->entries, map->count, sizeof(*map->entries), uid_data_cmp, NULL);
+
+	hash_init(map->table);
+	for (i = 0; i < map->count; i++)
+		hash_add(map->table, &map->entries[i].node, map->entries[i].uid);
+}
+
+// package may be NULL to match on uid alone
+static struct uid_data *uid_map_find(struct uid_map *map, u32 uid, const char *package)
+{
+	struct uid_data *np;
+
+	hash_for_each_possible (map->table, np, node, uid) {
+		if (np->uid != uid)
+			continue;
+		if (!package || !strncmp(np->package, package, KSU_MAX_PACKAGE_NAME))
+			return np;
+	}
+	return NULL;
+}
+
+static void uid_map_free(struct uid_map *map)
+{
+	size_t i;
+
+	if (!map)
+		return;
+
+	for (i = 0; i < map->count; i++)
+		kfree(map->entries[i].package);
+	if (map->entries)
+		kvfree(map->entries);
+	kfree(map);
+}
+
+/*
+ * merge walk of two sorted snapshots
+ * entries only in old go to removed, entries only in new are counted in *added
+ * a package whose uid changed shows up in both
+ */
+static int uid_map_diff(struct uid_map *old, struct uid_map *new, struct uid_map *removed, size_t *added)
+{
+	size_t i = 0, j = 0;
+	int ret;
+
+	*added = 0;
+	while (i < old->count || j < new->count) {
+		int cmp;
+
+		if (i == old->count)
+			cmp = 1;
+		else if (j == new->count)
+			cmp = -1;
+		else
+			cmp = uid_data_cmp(&old->entries[i], &new->entries[j]);
+
+		if (cmp < 0) {
+			ret = uid_map_append(removed, old->entries[i].uid, old->entries[i].package);
+			if (ret)
+				return ret;
+			i++;
+		} else if (cmp > 0) {
+			(*added)++;
+			j++;
+		} else {
+			i++;
+			j++;
+		}
+	}
+
+	uid_map_build(removed);
+	return 0;
+}
+
+static __always_inline void crown_manager(const char *apk, struct uid_map *uid_map)
 {
 	char pkg[KSU_MAX_PACKAGE_NAME];
 	if (get_pkg_from_apk_path(pkg, apk) < 0) {
@@ -18,10 +163,10 @@ static __always_inline void crown_manager(const char *apk, struct list_head *uid
 
 	pr_info("manager pkg: %s\n", pkg);
 
-	struct list_head *list = (struct list_head *)uid_data;
-	struct uid_data *np;
+	size_t i;
 
-	list_for_each_entry (np, list, list) {
+	for (i = 0; i < uid_map->count; i++) {
+		struct uid_data *np = &uid_map->entries[i];
 		if (strncmp(np->package, pkg, KSU_MAX_PACKAGE_NAME) == 0) {
 			pr_info("Crowning manager: %s(uid=%d)\n", pkg, np->uid);
 			ksu_set_manager_appid(np->uid);
@@ -143,9 +288,15 @@ FILLDIR_RETURN_TYPE my_actor(MY_ACTOR_CTX_ARG, const char *name,
 #define ksu_get_magic(x) ((x)->f_path.dentry->d_inode->i_sb->s_magic)
 #endif
 
-static noinline void search_manager(const char *path, int depth, struct list_head *uid_data)
+/*
+ * returns true when the search can be trusted: the manager was crowned or at
+ * least one base.apk was checked. an unreadable or still empty /data/app
+ * (too early in boot) returns false so the next pass searches again
+ */
+static noinline bool search_manager(const char *path, int depth, struct uid_map *uid_map)
 {
 	int i, stop = 0;
+	unsigned int checked = 0;
 	struct list_head data_path_list;
 	INIT_LIST_HEAD(&data_path_list);
 	unsigned long data_app_magic = 0;
@@ -153,7 +304,7 @@ static noinline void search_manager(const char *path, int depth, struct list_hea
 	// First depth
 	struct data_path *data __attribute__((__cleanup__(ksu_kfree_byref))) = kzalloc(sizeof(*data), GFP_KERNEL);
 	if (!data)
-		return;
+		return false;
 
 	strscpy(data->dirpath, path, DATA_PATH_LEN);
 	data->depth = depth;
@@ -212,13 +363,14 @@ static noinline void search_manager(const char *path, int depth, struct list_hea
 			if (!strstarts(candidate_path, "/data/ap") )
 				goto skip_iterate;
 
+			checked++;
 			bool is_manager = is_manager_apk(candidate_path);
 			pr_info("Found new base.apk at path: %s, is_manager: %d\n", candidate_path, is_manager);
 
 			if (likely(!is_manager))
 				goto skip_iterate;
 
-			crown_manager(candidate_path, uid_data);
+			crown_manager(candidate_path, uid_map);
 			stop = 1;
 
 skip_iterate:
@@ -228,159 +380,324 @@ skip_iterate:
 		}
 	}
 
+	return stop || checked;
 }
 
 static bool is_uid_exist(uid_t uid, char *package, void *data)
 {
-	struct list_head *list = (struct list_head *)data;
-	struct uid_data *np;
+	return !!uid_map_find((struct uid_map *)data, uid % PER_USER_RANGE, package);
+}
 
-	bool exist = false;
-	list_for_each_entry (np, list, list) {
-		if (np->uid == uid % PER_USER_RANGE &&
-		    strncmp(np->package, package, KSU_MAX_PACKAGE_NAME) == 0) {
-			exist = true;
-			break;
+// incremental prune, everything not in the removed set is still installed
+static bool is_uid_not_removed(uid_t uid, char *package, void *data)
+{
+	return !uid_map_find((struct uid_map *)data, uid % PER_USER_RANGE, package);
+}
+
+// line is "<package> <uid> <debuggable> <data dir> <seinfo> <gids>", we only want the first two
+static int parse_packages_line(char *line, struct uid_map *map)
+{
+	const char *delim = " ";
+	char *package = strsep(&line, delim);
+	char *uid = strsep(&line, delim);
+	u32 res;
+
+	if (!uid || !package || !*package) {
+		pr_err("update_uid: package or uid is NULL!\n");
+		return 0;
+	}
+
+	if (kstrtou32(uid, 10, &res)) {
+		pr_err("update_uid: uid parse err\n");
+		return 0;
+	}
+
+	return uid_map_append(map, res, package);
+}
+
+/*
+ * read packages.list a page at a time and split lines in memory
+ * a partial line at the end of the buffer is moved to the front and completed by the next read
+ * a line that does not fit a page is skipped whole
+ */
+static int parse_packages_list(struct file *fp, struct uid_map *map)
+{
+	char *buf __attribute__((__cleanup__(ksu_kfree_byref))) = kmalloc(PAGE_SIZE, GFP_KERNEL);
+	loff_t pos = 0;
+	size_t len = 0;
+	bool skip_line = false;
+	int ret = 0;
+
+	if (!buf)
+		return -ENOMEM;
+
+	map->hash = FNV1A64_OFFSET;
+	for (;;) {
+		ssize_t count = kernel_read(fp, buf + len, PAGE_SIZE - 1 - len, &pos);
+		if (count < 0)
+			return count;
+
+		map->hash = fnv1a64(map->hash, buf + len, count);
+		len += count;
+		buf[len] = '\0';
+
+		char *line = buf;
+		char *nl;
+		while ((nl = memchr(line, '\n', buf + len - line))) {
+			*nl = '\0';
+			if (!skip_line)
+				ret = parse_packages_line(line, map);
+			skip_line = false;
+			if (ret)
+				return ret;
+			line = nl + 1;
 		}
+
+		len -= line - buf;
+
+		if (count == 0) {
+			// last line without trailing newline
+			if (len && !skip_line)
+				ret = parse_packages_line(line, map);
+			return ret;
+		}
+
+		if (len == PAGE_SIZE - 1) {
+			pr_err("%s: line too long, skipping\n", __func__);
+			skip_line = true;
+			len = 0;
+			continue;
+		}
+
+		memmove(buf, line, len);
 	}
-	return exist;
 }
 
+/*
+ * snapshot of the last packages.list pass, protected by throne_tracker_mutex
+ * last_pruned: the allowlist has been fully reconciled against last_uid_map
+ *   at allowlist generation last_pruned_gen
+ * last_searched: manager presence was checked against last_uid_map
+ * incremental prunes only look at removed packages, so every
+ * THRONE_FULL_PRUNE_INTERVAL of them a full prune is forced anyway
+ */
+#define THRONE_FULL_PRUNE_INTERVAL 16
+
+static struct uid_map *last_uid_map = NULL;
+static bool last_pruned = false;
+static u32 last_pruned_gen = 0;
+static unsigned int incremental_prunes = 0;
+static bool last_searched = false;
+
 static void throne_tracker_fn(bool prune_only)
 {
+	struct uid_map *removed = NULL;
+	size_t added = 0;
+	u32 allowlist_gen = ksu_allowlist_gen();
+
+	// entries added since the last full prune may belong to packages that are gone
+	if (last_pruned && (allowlist_gen != last_pruned_gen ||
+			    incremental_prunes >= THRONE_FULL_PRUNE_INTERVAL))
+		last_pruned = false;
+
 	struct file *fp = filp_open(SYSTEM_PACKAGES_LIST_PATH, O_RDONLY, 0);
 	if (IS_ERR(fp)) {
 		pr_err("%s: open " SYSTEM_PACKAGES_LIST_PATH " failed: %ld\n", __func__, PTR_ERR(fp));
 		return;
 	}
 
-	struct list_head uid_list;
-	INIT_LIST_HEAD(&uid_list);
-
-	char chr = 0;
-	loff_t pos = 0;
-	loff_t line_start = 0;
-	char buf[KSU_MAX_PACKAGE_NAME];
-	for (;;) {
-		ssize_t count = kernel_read(fp, &chr, sizeof(chr), &pos);
-		if (count != sizeof(chr))
-			break;
-		if (chr != '\n')
-			continue;
+	struct uid_map *uid_map = kzalloc(sizeof(*uid_map), GFP_KERNEL);
+	if (!uid_map) {
+		filp_close(fp, 0);
+		return;
+	}
 
-		count = kernel_read(fp, buf, sizeof(buf) - 1, &line_start);
-		if (count <= 0) {
-			break;
-		}
-		buf[count] = '\0';
+	u64 start = ktime_get_ns();
+	int ret = parse_packages_list(fp, uid_map);
+	filp_close(fp, 0);
+	if (ret) {
+		pr_err("%s: parse " SYSTEM_PACKAGES_LIST_PATH " failed: %d\n", __func__, ret);
+		goto out;
+	}
 
-		struct uid_data *data = kzalloc(sizeof(struct uid_data), GFP_KERNEL);
-		if (!data) {
-			filp_close(fp, 0);
-			goto out;
-		}
+	// same content, and whatever this pass would do has already been done
+	if (last_uid_map && last_uid_map->hash == uid_map->hash &&
+	    (prune_only || last_searched) && (last_pruned || !ksu_boot_completed)) {
+		pr_info("%s: " SYSTEM_PACKAGES_LIST_PATH " unchanged, skip\n", __func__);
+		goto out;
+	}
 
-		char *tmp = buf;
-		const char *delim = " ";
-		char *package = strsep(&tmp, delim);
-		char *uid = strsep(&tmp, delim);
-		if (!uid || !package) {
-			kfree(data);
-			pr_err("update_uid: package or uid is NULL!\n");
-			break;
+	uid_map_build(uid_map);
+	pr_info("%s: %zu packages parsed in %llu us\n", __func__, uid_map->count, (ktime_get_ns() - start) / NSEC_PER_USEC);
+
+	if (last_uid_map) {
+		removed = kzalloc(sizeof(*removed), GFP_KERNEL);
+		if (!removed || uid_map_diff(last_uid_map, uid_map, removed, &added)) {
+			// fall back to a full pass
+			uid_map_free(removed);
+			removed = NULL;
+			last_pruned = false;
+			last_searched = false;
+		} else {
+			pr_info("%s: %zu removed, %zu added\n", __func__, removed->count, added);
 		}
-
-		u32 res;
-		if (kstrtou32(uid, 10, &res)) {
-			kfree(data);
-			pr_err("update_uid: uid parse err\n");
-			break;
-		}
-		data->uid = res;
-		strscpy(data->package, package, sizeof(data->package));
-		list_add_tail(&data->list, &uid_list);
-		// reset line start
-		line_start = pos;
 	}
-	filp_close(fp, 0);
 
-	// now update uid list
-	struct uid_data *np;
-	struct uid_data *n;
+	bool searched = last_searched && removed && !added;
 
 	if (prune_only)
 		goto prune;
 
 	// first, check if manager_uid exist!
-	bool manager_exist = false;
-	list_for_each_entry (np, &uid_list, list) {
-		if (np->uid == ksu_get_manager_appid()) {
-			manager_exist = true;
-			break;
-		}
-	}
-
-	if (!manager_exist) {
+	if (!uid_map_find(uid_map, ksu_get_manager_appid(), NULL)) {
 		if (ksu_is_manager_appid_valid()) {
 			pr_info("manager is uninstalled, invalidate it!\n");
 			ksu_invalidate_manager_uid();
 			goto prune;
 		}
-		pr_info("Searching manager...\n");
-		search_manager("/data/app", 2, &uid_list);
-		pr_info("Search manager finished\n");
+
+		// nothing new was installed since the last search came up empty
+		if (!searched) {
+			unsigned int hits, misses;
+			u64 search_start = ktime_get_ns();
+
+			pr_info("Searching manager...\n");
+			searched = search_manager("/data/app", 2, uid_map);
+			ksu_apk_verdict_stats(&hits, &misses);
+			pr_info("Search manager finished in %llu us, apk verdict cache hits: %u misses: %u%s\n",
+				(ktime_get_ns() - search_start) / NSEC_PER_USEC, hits, misses,
+				searched ? "" : ", nothing checked, will retry");
+		}
+	} else {
+		searched = true;
 	}
 
 prune:
 	// then prune the allowlist
-	ksu_prune_allowlist(is_uid_exist, &uid_list);
-out:
-	// free uid_list
-	list_for_each_entry_safe (np, n, &uid_list, list) {
-		list_del(&np->list);
-		kfree(np);
+	if (!ksu_boot_completed) {
+		last_pruned = false;
+	} else if (last_pruned && removed) {
+		if (removed->count) {
+			ksu_prune_allowlist(is_uid_not_removed, removed);
+			incremental_prunes++;
+		}
+	} else {
+		ksu_prune_allowlist(is_uid_exist, uid_map);
+		last_pruned = true;
+		last_pruned_gen = allowlist_gen;
+		incremental_prunes = 0;
 	}
+
+	last_searched = searched;
+	uid_map_free(last_uid_map);
+	last_uid_map = uid_map;
+	uid_map = NULL;
+out:
+	uid_map_free(removed);
+	uid_map_free(uid_map);
 }
 
 static DEFINE_MUTEX(throne_tracker_mutex);
 
-static int throne_tracker_thread(void *data)
+/*
+ * one long lived kthread does all threaded passes
+ * we keep a kthread instead of a workqueue so the escaped-to-root creds stay ours
+ * triggers that arrive within the debounce window of each other are folded into one pass
+ */
+#define THRONE_FULL_PASS 0
+#define THRONE_RESCAN 1
+#define THRONE_MAX_DEBOUNCE_ROUNDS 50
+
+static unsigned int ksu_throne_debounce_ms = 100;
+module_param(ksu_throne_debounce_ms, uint, 0644);
+
+// monitoring, read only
+static unsigned int ksu_throne_passes = 0;
+static unsigned int ksu_throne_coalesced = 0;
+static unsigned int ksu_throne_last_pass_us = 0;
+module_param(ksu_throne_passes, uint, 0444);
+module_param(ksu_throne_coalesced, uint, 0444);
+module_param(ksu_throne_last_pass_us, uint, 0444);
+
+static struct task_struct *throne_tracker_task = NULL;
+static DECLARE_WAIT_QUEUE_HEAD(throne_tracker_wq);
+static atomic_t throne_triggers = ATOMIC_INIT(0);
+static unsigned long throne_flags = 0;
+
+static void throne_tracker_pass(bool prune_only)
 {
-	// now de-void it here
-	bool prune_only = (bool)data;
-
-	pr_info("throne_tracker: pid: %d started\n", current->pid);
+	u64 start = ktime_get_ns();
 
 	mutex_lock(&throne_tracker_mutex);
+	// new verdicts came in, an earlier empty search no longer counts
+	if (test_and_clear_bit(THRONE_RESCAN, &throne_flags))
+		last_searched = false;
+	throne_tracker_fn(prune_only);
+	mutex_unlock(&throne_tracker_mutex);
 
-test_tmp:
-	if (!is_file_existing("/data/system/packages.list.tmp"))
-		goto test_list;
+	ksu_throne_passes++;
+	ksu_throne_last_pass_us = (ktime_get_ns() - start) / NSEC_PER_USEC;
+}
+
+static bool packages_list_settled(void)
+{
+	return !is_file_existing("/data/system/packages.list.tmp") &&
+	       is_file_stable(SYSTEM_PACKAGES_LIST_PATH);
+}
+
+/*
+ * wait until no trigger arrived for a whole window and the rename is done
+ * bounded, a steady stream of triggers still gets a pass every few seconds
+ */
+static void throne_tracker_debounce(void)
+{
+	int rounds = 0;
 
-	if (IS_ENABLED(CONFIG_KSU_DEBUG))
-		pr_info("throne_tracker: rename not finished! retry!\n");
+	for (;;) {
+		int seen = atomic_read(&throne_triggers);
 
-	msleep(20); // yield
-	goto test_tmp;
+		wait_event_interruptible_timeout(throne_tracker_wq,
+			atomic_read(&throne_triggers) != seen || kthread_should_stop(),
+			msecs_to_jiffies(READ_ONCE(ksu_throne_debounce_ms)));
 
-test_list:
-	if (is_file_stable(SYSTEM_PACKAGES_LIST_PATH))
-		goto start_tt;
+		if (kthread_should_stop() || ++rounds >= THRONE_MAX_DEBOUNCE_ROUNDS)
+			return;
 
-	if (IS_ENABLED(CONFIG_KSU_DEBUG))
-		pr_info("throne_tracker: rename not finished! retry!\n");
+		if (atomic_read(&throne_triggers) != seen)
+			continue;
 
-	msleep(20); // yield
-	goto test_list;	
+		if (packages_list_settled())
+			return;
+
+		if (IS_ENABLED(CONFIG_KSU_DEBUG))
+			pr_info("throne_tracker: rename not finished! retry!\n");
+	}
+}
+
+static int throne_tracker_thread(void *data)
+{
+	pr_info("throne_tracker: pid: %d started\n", current->pid);
 
-start_tt:
 	// lessen that window where user opens manager right away, yet its not crowned
 	set_user_nice(current, -10);
 
-	escape_to_root_forced();
-	throne_tracker_fn(prune_only);
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(throne_tracker_wq,
+			atomic_read(&throne_triggers) || kthread_should_stop());
 
-	mutex_unlock(&throne_tracker_mutex);
+		if (kthread_should_stop())
+			break;
+
+		throne_tracker_debounce();
+
+		int triggers = atomic_xchg(&throne_triggers, 0);
+		bool prune_only = !test_and_clear_bit(THRONE_FULL_PASS, &throne_flags);
+		if (triggers > 1)
+			ksu_throne_coalesced += triggers - 1;
+
+		escape_to_root_forced();
+		throne_tracker_pass(prune_only);
+	}
 
 	pr_info("throne_tracker: pid: %d exit!\n", current->pid);
 	return 0;
@@ -391,24 +708,53 @@ void track_throne(bool prune_only)
 #ifndef CONFIG_KSU_THRONE_TRACKER_ALWAYS_THREADED
 	static bool throne_tracker_first_run __read_mostly = true;
 	if (unlikely(throne_tracker_first_run)) {
-		mutex_lock(&throne_tracker_mutex);
-		throne_tracker_fn(prune_only);
-		mutex_unlock(&throne_tracker_mutex);
+		throne_tracker_pass(prune_only);
 		throne_tracker_first_run = false;
 		return;
 	}
 #endif
 
-	// HACK: force cast prune_only to be a void *
-	kthread_run(throne_tracker_thread, (void *)prune_only, "ksu_throne");
+	if (unlikely(!throne_tracker_task)) {
+		pr_err("throne_tracker: no tracker thread!\n");
+		return;
+	}
+
+	if (!prune_only)
+		set_bit(THRONE_FULL_PASS, &throne_flags);
+
+	atomic_inc(&throne_triggers);
+	wake_up(&throne_tracker_wq);
+}
+
+// search /data/app again on the next pass even if packages.list did not change
+void ksu_throne_tracker_rescan()
+{
+	set_bit(THRONE_RESCAN, &throne_flags);
+	track_throne(false);
 }
 
 void ksu_throne_tracker_init()
 {
-	// nothing to do
+	struct task_struct *task = kthread_run(throne_tracker_thread, NULL, "ksu_throne");
+	if (IS_ERR(task)) {
+		pr_err("throne_tracker: kthread_run failed: %ld\n", PTR_ERR(task));
+		return;
+	}
+
+	throne_tracker_task = task;
 }
 
 void ksu_throne_tracker_exit()
 {
-	// nothing to do
+	if (throne_tracker_task) {
+		kthread_stop(throne_tracker_task);
+		throne_tracker_task = NULL;
+	}
+
+	mutex_lock(&throne_tracker_mutex);
+	uid_map_free(last_uid_map);
+	last_uid_map = NULL;
+	mutex_unlock(&throne_tracker_mutex);
+
+	ksu_apk_sign_exit();
 }
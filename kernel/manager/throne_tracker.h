@@ -7,6 +7,8 @@ void ksu_throne_tracker_exit();
 
 void track_throne(bool prune_only);
 
+void ksu_throne_tracker_rescan();
+
 /*
  * small helper to check if file exists
  * true - file exists
@@ -40,6 +40,8 @@ struct perm_data {
 #define ALLOW_LIST_BITS 8
 static DEFINE_HASHTABLE(allow_list, ALLOW_LIST_BITS);
 static u16 allow_list_count = 0;
+// bumped under allowlist_mutex whenever an entry is added
+static u32 allow_list_gen = 0;
 
 #define KERNEL_SU_ALLOWLIST "/data/adb/ksu/.allowlist"
 
@@ -197,6 +199,7 @@ int ksu_set_app_profile(struct app_profile *profile)
 
 	hash_add_rcu(allow_list, &np->list, np->profile.curr_uid);
 	++allow_list_count;
+	WRITE_ONCE(allow_list_gen, allow_list_gen + 1);
 
 out:
 	result = 0;
@@ -208,6 +211,10 @@ out:
 
 out_unlock:
 	mutex_unlock(&allowlist_mutex);
+
+	// resolve the domain now rather than on the first grant
+	if (!result && profile->allow_su && !profile->rp_config.use_default)
+		ksu_cache_domain_sid(profile->rp_config.profile.selinux_domain);
 	return result;
 }
 
@@ -519,6 +526,11 @@ exit:
 	filp_close(fp, 0);
 }
 
+u32 ksu_allowlist_gen(void)
+{
+	return READ_ONCE(allow_list_gen);
+}
+
 void ksu_prune_allowlist(bool (*is_uid_valid)(uid_t, char *, void *), void *data)
 {
 	struct perm_data *np = NULL;
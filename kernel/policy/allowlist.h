@@ -29,6 +29,8 @@ bool __ksu_is_allow_uid_for_current(uid_t uid);
 bool ksu_get_allow_list(int *array, u16 length, u16 *out_length, u16 *out_total, bool allow);
 
 void ksu_prune_allowlist(bool (*is_uid_exist)(uid_t, char *, void *), void *data);
+// changes whenever an entry is added, lets the tracker know a full prune is due
+u32 ksu_allowlist_gen(void);
 void ksu_persistent_allow_list();
 
 // should be called with rcu read lock
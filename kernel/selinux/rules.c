@@ -136,6 +136,15 @@ static int apply_kernelsu_rules_fn(void *ptr)
 	return 0;
 }
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+/*
+ * bumped with every policy we swap in, under policy_mutex
+ * the replaced policy is freed right away and the next dup may get its
+ * address back, so pointer and latest_granting can't tell that a swap happened
+ */
+static u64 ksu_policy_swap_gen = 0;
+#endif
+
 void apply_kernelsu_rules()
 {
 	struct policydb *db;
@@ -154,9 +163,18 @@ void apply_kernelsu_rules()
 	}
 	db = &pol->policydb;
 
+	unsigned long changes = ksu_sepolicy_changes();
 	apply_kernelsu_rules_fn((void *)db);
 
+	// already there (late load after a previous run), keep the live policy
+	if (ksu_sepolicy_changes() == changes) {
+		pr_info("%s: policy unchanged\n", __func__);
+		ksu_destroy_sepolicy(pol);
+		goto out_unlock;
+	}
+
 	rcu_assign_pointer(selinux_state.policy, pol);
+	ksu_policy_swap_gen++;
 	synchronize_rcu();
 	ksu_destroy_sepolicy(old_pol);
 
@@ -166,6 +184,7 @@ out_unlock:
 #else
 
 	db = get_policydb();
+	unsigned long changes = ksu_sepolicy_changes();
 
 	rwlock_t *lock = ksu_get_policy_rwlock();
 	if (!lock)
@@ -198,7 +217,8 @@ do_stop_machine:
 
 out_flush:
 	smp_mb();
-	reset_avc_cache();
+	if (ksu_sepolicy_changes() != changes)
+		reset_avc_cache();
 #endif
 }
 
@@ -213,6 +233,9 @@ struct sepol_data {
 struct sepol_batch_cursor {
 	const u8 *cur;
 	const u8 *end;
+	bool interned; // v2 batch
+	const char **strings; // v2 string table
+	u32 nr_strings;
 };
 
 static size_t sepol_remaining(const struct sepol_batch_cursor *cursor)
@@ -263,6 +286,157 @@ static int sepol_read_string(struct sepol_batch_cursor *cursor, const char **out
 	return 0;
 }
 
+/*
+ * v2 batches carry each distinct name once, arguments are u16 indices into
+ * that table, so equal names also end up as the same pointer
+ */
+static int sepol_read_string_table(struct sepol_batch_cursor *cursor)
+{
+	u32 magic, nr, i;
+	int ret;
+
+	if (sepol_remaining(cursor) < sizeof(magic) + sizeof(nr))
+		return 0;
+
+	memcpy(&magic, cursor->cur, sizeof(magic));
+	if (magic != KSU_SEPOLICY_V2_MAGIC)
+		return 0; // v1
+
+	memcpy(&nr, cursor->cur + sizeof(magic), sizeof(nr));
+	cursor->cur += sizeof(magic) + sizeof(nr);
+	cursor->interned = true;
+
+	// each entry takes at least 6 bytes, KSU_SEPOLICY_V2_ALL is no index
+	if (nr >= KSU_SEPOLICY_V2_ALL || nr > sepol_remaining(cursor) / 6)
+		return -EINVAL;
+	if (!nr)
+		return 0;
+
+	cursor->strings = kvmalloc(nr * sizeof(*cursor->strings), GFP_KERNEL);
+	if (!cursor->strings)
+		return -ENOMEM;
+	cursor->nr_strings = nr;
+
+	for (i = 0; i < nr; i++) {
+		ret = sepol_read_string(cursor, &cursor->strings[i]);
+		if (ret < 0)
+			return ret;
+		// ALL has its own index
+		if (cursor->strings[i] == ALL)
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void sepol_cursor_release(struct sepol_batch_cursor *cursor)
+{
+	if (cursor->strings)
+		kvfree(cursor->strings);
+	cursor->strings = NULL;
+}
+
+static int sepol_cursor_init(struct sepol_batch_cursor *cursor, const u8 *payload, size_t len)
+{
+	int ret;
+
+	cursor->cur = payload;
+	cursor->end = payload + len;
+	cursor->interned = false;
+	cursor->strings = NULL;
+	cursor->nr_strings = 0;
+
+	ret = sepol_read_string_table(cursor);
+	if (ret < 0) {
+		pr_err("sepol: bad string table.\n");
+		sepol_cursor_release(cursor);
+	}
+	return ret;
+}
+
+static int sepol_read_arg(struct sepol_batch_cursor *cursor, const char **out)
+{
+	u16 index;
+
+	if (!cursor->interned)
+		return sepol_read_string(cursor, out);
+
+	if (sepol_remaining(cursor) < sizeof(index))
+		return -EINVAL;
+
+	memcpy(&index, cursor->cur, sizeof(index));
+	cursor->cur += sizeof(index);
+
+	if (index == KSU_SEPOLICY_V2_ALL) {
+		*out = ALL;
+		return 0;
+	}
+	if (index >= cursor->nr_strings)
+		return -EINVAL;
+
+	*out = cursor->strings[index];
+	return 0;
+}
+
+/*
+ * set argument of a v2 batch: [u16 count][count * u16 index]
+ * a set holding ALL is ALL (count 0), indices are left in the payload
+ */
+static int sepol_read_set(struct sepol_batch_cursor *cursor, struct ksu_sepol_set *set)
+{
+	u16 count, index;
+	u32 i;
+
+	if (!cursor->interned || sepol_remaining(cursor) < sizeof(count))
+		return -EINVAL;
+
+	memcpy(&count, cursor->cur, sizeof(count));
+	cursor->cur += sizeof(count);
+
+	if (!count || sepol_remaining(cursor) < count * sizeof(index))
+		return -EINVAL;
+
+	set->table = cursor->strings;
+	set->indices = cursor->cur;
+	set->count = count;
+
+	for (i = 0; i < count; i++) {
+		memcpy(&index, cursor->cur + i * sizeof(index), sizeof(index));
+		if (index == KSU_SEPOLICY_V2_ALL)
+			set->count = 0;
+		else if (index >= cursor->nr_strings)
+			return -EINVAL;
+	}
+
+	cursor->cur += count * sizeof(index);
+	return 0;
+}
+
+static bool sepol_is_set_cmd(u32 cmd)
+{
+	return cmd == KSU_SEPOLICY_CMD_NORMAL_PERM_SET;
+}
+
+static int sepol_read_args(struct sepol_batch_cursor *cursor, const struct sepol_data *header, u32 argc,
+			   const char **args, struct ksu_sepol_set *sets, u32 cmd_index)
+{
+	u32 arg_index;
+	int ret = 0;
+
+	for (arg_index = 0; arg_index < argc; arg_index++) {
+		if (sepol_is_set_cmd(header->cmd))
+			ret = sepol_read_set(cursor, &sets[arg_index]);
+		else
+			ret = sepol_read_arg(cursor, &args[arg_index]);
+		if (ret < 0) {
+			pr_err("sepol: failed to read cmd #%u arg #%u.\n", cmd_index, arg_index);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
 static int sepol_require_not_all(const char *value, const char *name)
 {
 	if (value != ALL) {
@@ -277,6 +451,7 @@ static int sepol_expected_argc(u32 cmd)
 {
 	switch (cmd) {
 	case KSU_SEPOLICY_CMD_NORMAL_PERM:
+	case KSU_SEPOLICY_CMD_NORMAL_PERM_SET:
 		return 4;
 	case KSU_SEPOLICY_CMD_XPERM:
 		return 5;
@@ -298,12 +473,64 @@ static int sepol_expected_argc(u32 cmd)
 	}
 }
 
-static int apply_one_sepolicy_cmd(struct policydb *db, const struct sepol_data *header, const char **args)
+/*
+ * type / attribute commands in the next max_cmds commands of the batch, so the
+ * type arrays are grown once up front instead of once per new type
+ * a malformed tail is not counted, the real pass reports it
+ */
+static u32 sepol_count_new_types(struct sepol_batch_cursor cursor, u32 max_cmds)
+{
+	u32 count = 0;
+
+	while (cursor.cur < cursor.end && max_cmds--) {
+		struct sepol_data header;
+		struct ksu_sepol_set set;
+		const char *arg;
+		int argc, i;
+
+		if (sepol_read_cmd_header(&cursor, &header) < 0)
+			break;
+		argc = sepol_expected_argc(header.cmd);
+		if (argc < 0)
+			break;
+		for (i = 0; i < argc; i++) {
+			int ret;
+
+			if (sepol_is_set_cmd(header.cmd))
+				ret = sepol_read_set(&cursor, &set);
+			else
+				ret = sepol_read_arg(&cursor, &arg);
+			if (ret < 0)
+				return count;
+		}
+		if (header.cmd == KSU_SEPOLICY_CMD_TYPE || header.cmd == KSU_SEPOLICY_CMD_ATTR)
+			count++;
+	}
+
+	return count;
+}
+
+static int apply_one_sepolicy_cmd(struct policydb *db, const struct sepol_data *header, const char **args,
+				  const struct ksu_sepol_set *sets)
 {
 	bool success = false;
 	int ret;
 
 	switch (header->cmd) {
+	case KSU_SEPOLICY_CMD_NORMAL_PERM_SET:
+		if (header->subcmd == KSU_SEPOLICY_SUBCMD_NORMAL_PERM_ALLOW) {
+			success = ksu_allow_set(db, &sets[0], &sets[1], &sets[2], &sets[3]);
+		} else if (header->subcmd == KSU_SEPOLICY_SUBCMD_NORMAL_PERM_DENY) {
+			success = ksu_deny_set(db, &sets[0], &sets[1], &sets[2], &sets[3]);
+		} else if (header->subcmd == KSU_SEPOLICY_SUBCMD_NORMAL_PERM_AUDITALLOW) {
+			success = ksu_auditallow_set(db, &sets[0], &sets[1], &sets[2], &sets[3]);
+		} else if (header->subcmd == KSU_SEPOLICY_SUBCMD_NORMAL_PERM_DONTAUDIT) {
+			success = ksu_dontaudit_set(db, &sets[0], &sets[1], &sets[2], &sets[3]);
+		} else {
+			pr_err("sepol: unknown subcmd: %d\n", header->subcmd);
+		}
+		return success ? 0 : -EINVAL;
+
 	case KSU_SEPOLICY_CMD_NORMAL_PERM:
 		if (header->subcmd == KSU_SEPOLICY_SUBCMD_NORMAL_PERM_ALLOW) {
 			success = ksu_allow(db, args[0], args[1], args[2], args[3]);
@@ -467,16 +694,486 @@ static int apply_one_sepolicy_cmd(struct policydb *db, const struct sepol_data *
 	}
 }
 
+/*
+ * per batch outcome
+ * results gets one KSU_SEPOLICY_RESULT_* per command when the caller asked for it
+ * changed counts commands that really modified the policy, 0 means the whole
+ * batch was already in place and there is nothing to swap in or flush
+ */
+struct sepol_batch_result {
+	u8 *results;
+	u32 results_len;
+	u32 changed;
+	u32 count; // commands walked
+};
+
+// selinux_hide tracks src/tgt pairs, a set command stands for all of its pairs
+static void sepol_track_cmd(const struct sepol_data *header, const char **args, const struct ksu_sepol_set *sets)
+{
+	const char *pair[KSU_SEPOLICY_MAX_ARGS] = { 0 };
+	u32 si, ti;
+
+	if (!sepol_is_set_cmd(header->cmd)) {
+		ksu_add_shit_to_list(header->cmd, args);
+		return;
+	}
+
+	for (si = 0; si < sets[0].count; si++) {
+		for (ti = 0; ti < sets[1].count; ti++) {
+			pair[0] = ksu_sepol_set_name(&sets[0], si);
+			pair[1] = ksu_sepol_set_name(&sets[1], ti);
+			ksu_add_shit_to_list(KSU_SEPOLICY_CMD_NORMAL_PERM, pair);
+		}
+	}
+}
+
+static int apply_one_sepolicy_cmd_tracked(struct policydb *db, const struct sepol_data *header, const char **args,
+					  const struct ksu_sepol_set *sets, struct sepol_batch_result *res, u32 cmd_index)
+{
+	unsigned long changes = ksu_sepolicy_changes();
+	u8 result;
+	int ret;
+
+	ret = apply_one_sepolicy_cmd(db, header, args, sets);
+	if (ret < 0)
+		result = KSU_SEPOLICY_RESULT_FAILED;
+	else if (ksu_sepolicy_changes() != changes)
+		result = KSU_SEPOLICY_RESULT_APPLIED;
+	else
+		result = KSU_SEPOLICY_RESULT_NOOP;
+
+	if (result == KSU_SEPOLICY_RESULT_APPLIED)
+		res->changed++;
+	if (res->results && cmd_index < res->results_len)
+		res->results[cmd_index] = result;
+
+	return ret;
+}
+
+static int sepol_alloc_results(struct sepol_batch_result *res, u8 __user *results, u32 results_len)
+{
+	if (!results || !results_len)
+		return 0;
+
+	// there can't be more commands than 8 bytes of header each
+	if (results_len > KSU_SEPOLICY_MAX_BATCH_SIZE / sizeof(struct sepol_data))
+		return -E2BIG;
+
+	res->results = kvmalloc(results_len, GFP_KERNEL);
+	if (!res->results)
+		return -ENOMEM;
+
+	memset(res->results, 0, results_len);
+
+	res->results_len = results_len;
+	return 0;
+}
+
+// copy the per command results out, keeps ret unless that fails
+static int sepol_put_results(struct sepol_batch_result *res, u8 __user *results, int ret)
+{
+	if (!res->results)
+		return ret;
+
+	if (ret >= 0 && copy_to_user(results, res->results, res->results_len))
+		ret = -EFAULT;
+
+	kvfree(res->results);
+	res->results = NULL;
+	return ret;
+}
+
+/*
+ * ksud probes for v2 with a bare header, [magic][0 strings] and no commands
+ * answered with 0 before the policy is touched, kernels without v2 reject
+ * the magic as an unknown first command instead
+ */
+static bool sepol_is_v2_probe(const u8 *payload, size_t len)
+{
+	u32 head[2];
+
+	if (len != sizeof(head))
+		return false;
+
+	memcpy(head, payload, sizeof(head));
+	return head[0] == KSU_SEPOLICY_V2_MAGIC && head[1] == 0;
+}
+
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
-int handle_sepolicy(void __user *user_data, u64 data_len)
+/*
+ * walk a serialized batch and apply it to db
+ * with db == NULL the batch is only parsed, so a malformed one can be
+ * rejected before anything touches the policy
+ * track feeds selinux_hide, applied commands with a db, every command without
+ * returns the number of commands applied, < 0 if the batch is malformed
+ */
+static int sepol_apply_payload(struct policydb *db, const u8 *payload, size_t len, struct sepol_batch_result *res,
+			       bool track)
 {
-	struct selinux_policy *pol, *old_pol;
-	struct policydb *db;
 	struct sepol_batch_cursor cursor;
-	u8 *payload;
+	int success_cmd_count = 0;
+	u32 cmd_index = 0;
 	int ret;
-	int success_cmd_count;
-	u32 cmd_index;
+
+	ret = sepol_cursor_init(&cursor, payload, len);
+	if (ret < 0)
+		goto out;
+
+	if (db) {
+		ksu_sepolicy_batch_begin(cursor.interned);
+		ksu_reserve_types(db, sepol_count_new_types(cursor, U32_MAX));
+	}
+
+	while (cursor.cur < cursor.end) {
+		struct sepol_data header;
+		const char *args[KSU_SEPOLICY_MAX_ARGS] = { 0 };
+		struct ksu_sepol_set sets[KSU_SEPOLICY_MAX_ARGS];
+		int expected_argc;
+
+		ret = sepol_read_cmd_header(&cursor, &header);
+		if (ret < 0) {
+			pr_err("sepol: failed to read cmd header #%u.\n", cmd_index);
+			goto out_release;
+		}
+
+		expected_argc = sepol_expected_argc(header.cmd);
+		if (expected_argc < 0 || expected_argc > KSU_SEPOLICY_MAX_ARGS) {
+			pr_err("sepol: invalid cmd header #%u.\n", cmd_index);
+			ret = -EINVAL;
+			goto out_release;
+		}
+
+		ret = sepol_read_args(&cursor, &header, (u32)expected_argc, args, sets, cmd_index);
+		if (ret < 0)
+			goto out_release;
+
+		if (db) {
+			ret = apply_one_sepolicy_cmd_tracked(db, &header, args, sets, res, cmd_index);
+			if (ret < 0) {
+				pr_err("sepol: cmd #%u failed, cmd=%u subcmd=%u.\n", cmd_index, header.cmd, header.subcmd);
+			} else {
+				success_cmd_count++;
+				if (track)
+					sepol_track_cmd(&header, args, sets);
+			}
+		} else if (track) {
+			sepol_track_cmd(&header, args, sets);
+		}
+		cmd_index++;
+	}
+
+	res->count = cmd_index;
+	ret = success_cmd_count;
+out_release:
+	// a parse only pass runs without policy_mutex, the batch state belongs to whoever holds it
+	if (db)
+		ksu_sepolicy_batch_end();
+	sepol_cursor_release(&cursor);
+out:
+	return ret;
+}
+
+/*
+ * sepolicy transaction
+ * batches sent while one is open go into a private copy of the policy,
+ * commit swaps it in once, so n module rule files cost one dup and one avc reset
+ * the owner never holds policy_mutex across syscalls, commit instead checks
+ * that nobody replaced the policy in between and bails with -EAGAIN if so
+ * the batches are kept until then, selinux_hide only learns about them on
+ * commit, an aborted transaction (ksud's bench) must not grow the hide list
+ */
+struct sepol_txn_batch {
+	struct list_head list;
+	size_t len;
+	u8 payload[];
+};
+
+struct sepol_txn {
+	struct selinux_policy *pol; // private copy, NULL if no transaction is open
+	struct selinux_policy *base; // live policy pol was copied from
+	u32 base_seqno;
+	u64 base_gen; // ksu_policy_swap_gen at begin
+	pid_t owner; // tgid
+	int applied;
+	u32 changed;
+	struct list_head batches; // struct sepol_txn_batch
+};
+
+static struct sepol_txn sepol_txn = { .batches = LIST_HEAD_INIT(sepol_txn.batches) };
+static DEFINE_MUTEX(sepol_txn_mutex);
+
+static bool sepol_txn_owner_alive(pid_t owner)
+{
+	bool alive;
+
+	rcu_read_lock();
+	alive = !!find_task_by_vpid(owner);
+	rcu_read_unlock();
+
+	return alive;
+}
+
+static void sepol_txn_drop(void)
+{
+	struct sepol_txn_batch *batch, *tmp;
+
+	if (sepol_txn.pol)
+		ksu_destroy_sepolicy(sepol_txn.pol);
+
+	list_for_each_entry_safe(batch, tmp, &sepol_txn.batches, list) {
+		list_del(&batch->list);
+		kvfree(batch);
+	}
+
+	sepol_txn.pol = NULL;
+	sepol_txn.base = NULL;
+	sepol_txn.base_seqno = 0;
+	sepol_txn.base_gen = 0;
+	sepol_txn.owner = 0;
+	sepol_txn.applied = 0;
+	sepol_txn.changed = 0;
+}
+
+// the transaction made it into the live policy, let selinux_hide see its batches
+static void sepol_txn_track(void)
+{
+	struct sepol_txn_batch *batch;
+	struct sepol_batch_result res = { 0 };
+
+	list_for_each_entry(batch, &sepol_txn.batches, list)
+		sepol_apply_payload(NULL, batch->payload, batch->len, &res, true);
+}
+
+static int sepol_txn_begin(void)
+{
+	struct selinux_policy *pol, *old_pol;
+	u32 base_seqno;
+	u64 base_gen;
+	int ret = 0;
+
+	mutex_lock(&sepol_txn_mutex);
+	if (sepol_txn.pol) {
+		if (sepol_txn.owner == current->tgid || sepol_txn_owner_alive(sepol_txn.owner)) {
+			ret = -EBUSY;
+			goto out;
+		}
+		// owner died halfway, take it over
+		pr_info("sepol: dropping transaction of dead owner %d\n", sepol_txn.owner);
+		sepol_txn_drop();
+	}
+
+	mutex_lock(&selinux_state.policy_mutex);
+	old_pol = rcu_dereference_protected(selinux_state.policy, lockdep_is_held(&selinux_state.policy_mutex));
+	pol = ksu_dup_sepolicy(old_pol);
+	// old_pol may be gone once the mutex is dropped, only its address is kept
+	base_seqno = old_pol->latest_granting;
+	base_gen = ksu_policy_swap_gen;
+	mutex_unlock(&selinux_state.policy_mutex);
+
+	if (IS_ERR(pol)) {
+		ret = PTR_ERR(pol);
+		pr_err("ksu_dup_sepolicy err: %d\n", ret);
+		goto out;
+	}
+
+	sepol_txn.pol = pol;
+	sepol_txn.base = old_pol;
+	sepol_txn.base_seqno = base_seqno;
+	sepol_txn.base_gen = base_gen;
+	sepol_txn.owner = current->tgid;
+	sepol_txn.applied = 0;
+	sepol_txn.changed = 0;
+	pr_info("sepol: transaction begin, owner: %d\n", sepol_txn.owner);
+out:
+	mutex_unlock(&sepol_txn_mutex);
+	return ret;
+}
+
+static int sepol_txn_commit(void)
+{
+	struct selinux_policy *old_pol;
+	int ret;
+
+	mutex_lock(&sepol_txn_mutex);
+	if (!sepol_txn.pol || sepol_txn.owner != current->tgid) {
+		ret = -ENOENT;
+		goto out;
+	}
+
+	ret = sepol_txn.applied;
+
+	mutex_lock(&selinux_state.policy_mutex);
+	old_pol = rcu_dereference_protected(selinux_state.policy, lockdep_is_held(&selinux_state.policy_mutex));
+	if (old_pol != sepol_txn.base || old_pol->latest_granting != sepol_txn.base_seqno ||
+	    ksu_policy_swap_gen != sepol_txn.base_gen) {
+		mutex_unlock(&selinux_state.policy_mutex);
+		pr_err("sepol: policy changed during transaction, dropped\n");
+		sepol_txn_drop();
+		ret = -EAGAIN;
+		goto out;
+	}
+
+	// every batch was already in place, the live policy is as good as the copy
+	if (!sepol_txn.changed) {
+		mutex_unlock(&selinux_state.policy_mutex);
+		pr_info("sepol: transaction was a no-op, %d commands\n", ret);
+		sepol_txn_track();
+		sepol_txn_drop();
+		goto out;
+	}
+
+	rcu_assign_pointer(selinux_state.policy, sepol_txn.pol);
+	ksu_policy_swap_gen++;
+	synchronize_rcu();
+	ksu_destroy_sepolicy(old_pol);
+
+	reset_avc_cache();
+	mutex_unlock(&selinux_state.policy_mutex);
+
+	pr_info("sepol: transaction committed, %d commands applied, %u changed the policy\n", ret, sepol_txn.changed);
+	sepol_txn.pol = NULL;
+	sepol_txn_track();
+	sepol_txn_drop();
+out:
+	mutex_unlock(&sepol_txn_mutex);
+	return ret;
+}
+
+static int sepol_txn_abort(void)
+{
+	int ret = 0;
+
+	mutex_lock(&sepol_txn_mutex);
+	if (!sepol_txn.pol || (sepol_txn.owner != current->tgid && sepol_txn_owner_alive(sepol_txn.owner)))
+		ret = -ENOENT;
+	else
+		sepol_txn_drop();
+	mutex_unlock(&sepol_txn_mutex);
+
+	return ret;
+}
+
+/*
+ * a driver fd was released, drop a transaction whose owner is gone or is the
+ * one closing it, so a dead ksud does not pin a policy copy until the next BEGIN
+ * release may run from a kworker after the owner exited, hence the alive check
+ */
+void ksu_sepolicy_txn_release(void)
+{
+	mutex_lock(&sepol_txn_mutex);
+	if (sepol_txn.pol && (sepol_txn.owner == current->tgid || !sepol_txn_owner_alive(sepol_txn.owner))) {
+		pr_info("sepol: dropping transaction of owner %d on fd release\n", sepol_txn.owner);
+		sepol_txn_drop();
+	}
+	mutex_unlock(&sepol_txn_mutex);
+}
+
+int handle_sepolicy_txn(u32 op)
+{
+	switch (op) {
+	case KSU_SEPOLICY_TXN_BEGIN:
+		return sepol_txn_begin();
+	case KSU_SEPOLICY_TXN_COMMIT:
+		return sepol_txn_commit();
+	case KSU_SEPOLICY_TXN_ABORT:
+		return sepol_txn_abort();
+	default:
+		return -EINVAL;
+	}
+}
+
+// apply into the open transaction of the caller, -ENOENT if it has none
+static int sepol_txn_apply(const u8 *payload, size_t len, struct sepol_batch_result *res)
+{
+	struct sepol_txn_batch *batch;
+	int ret;
+
+	mutex_lock(&sepol_txn_mutex);
+	if (!sepol_txn.pol || sepol_txn.owner != current->tgid) {
+		ret = -ENOENT;
+		goto out;
+	}
+
+	// the copy is shared by all batches, never leave half a batch in it
+	ret = sepol_apply_payload(NULL, payload, len, res, false);
+	if (ret < 0)
+		goto out;
+
+	// kept for the hide list, tracked on commit
+	batch = kvmalloc(sizeof(*batch) + len, GFP_KERNEL);
+	if (!batch) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	batch->len = len;
+	memcpy(batch->payload, payload, len);
+
+	// the txn copy is private, but the batch state is shared with the live path
+	mutex_lock(&selinux_state.policy_mutex);
+	ret = sepol_apply_payload(&sepol_txn.pol->policydb, payload, len, res, false);
+	mutex_unlock(&selinux_state.policy_mutex);
+	if (ret > 0)
+		sepol_txn.applied += ret;
+	sepol_txn.changed += res->changed;
+	list_add_tail(&batch->list, &sepol_txn.batches);
+out:
+	mutex_unlock(&sepol_txn_mutex);
+	return ret;
+}
+
+/*
+ * the last batch that turned out to be a no-op against the live policy, ksud
+ * sends the same module rules again on every load. an identical batch is
+ * answered from here without duplicating the policy, as long as the live
+ * policy is the same object, was not reloaded and none of our mutators ran
+ * since. only batches where every command was NOOP are kept
+ * protected by policy_mutex
+ */
+static struct {
+	struct selinux_policy *pol;
+	u32 seqno;
+	u64 gen;
+	unsigned long changes;
+	u8 *payload;
+	size_t len;
+	u32 count;
+} sepol_noop_memo;
+
+static bool sepol_noop_memo_hit(struct selinux_policy *pol, const u8 *payload, size_t len)
+{
+	return sepol_noop_memo.payload && sepol_noop_memo.pol == pol &&
+	       sepol_noop_memo.seqno == pol->latest_granting && sepol_noop_memo.gen == ksu_policy_swap_gen &&
+	       sepol_noop_memo.changes == ksu_sepolicy_changes() &&
+	       sepol_noop_memo.len == len && !memcmp(sepol_noop_memo.payload, payload, len);
+}
+
+static void sepol_noop_memo_store(struct selinux_policy *pol, const u8 *payload, size_t len, u32 count)
+{
+	if (sepol_noop_memo.len != len) {
+		u8 *copy = kvmalloc(len, GFP_KERNEL);
+
+		if (!copy)
+			return;
+		if (sepol_noop_memo.payload)
+			kvfree(sepol_noop_memo.payload);
+		sepol_noop_memo.payload = copy;
+		sepol_noop_memo.len = len;
+	}
+
+	memcpy(sepol_noop_memo.payload, payload, len);
+	sepol_noop_memo.pol = pol;
+	sepol_noop_memo.seqno = pol->latest_granting;
+	sepol_noop_memo.gen = ksu_policy_swap_gen;
+	sepol_noop_memo.changes = ksu_sepolicy_changes();
+	sepol_noop_memo.count = count;
+}
+
+int handle_sepolicy(void __user *user_data, u64 data_len, u8 __user *results, u32 results_len)
+{
+	struct selinux_policy *pol, *old_pol;
+	struct sepol_batch_result res = { 0 };
+	u8 *payload;
+	int ret = 0;
 
 	if (!user_data || !data_len) {
 		return -EINVAL;
@@ -496,76 +1193,65 @@ int handle_sepolicy(void __user *user_data, u64 data_len)
 		goto out_free;
 	}
 
+	if (sepol_is_v2_probe(payload, (size_t)data_len))
+		goto out_free;
+
+	ret = sepol_alloc_results(&res, results, results_len);
+	if (ret < 0)
+		goto out_free;
+
 	if (!getenforce()) {
 		pr_info("SELinux permissive or disabled when handle policy!\n");
 	}
 
+	ret = sepol_txn_apply(payload, (size_t)data_len, &res);
+	if (ret != -ENOENT)
+		goto out_results;
+
 	mutex_lock(&selinux_state.policy_mutex);
 
-	old_pol = selinux_state.policy;
-	pol = ksu_dup_sepolicy(rcu_dereference_protected(old_pol, lockdep_is_held(&selinux_state.policy_mutex)));
+	old_pol = rcu_dereference_protected(selinux_state.policy, lockdep_is_held(&selinux_state.policy_mutex));
+	if (sepol_noop_memo_hit(old_pol, payload, (size_t)data_len)) {
+		pr_info("sepol: same no-op batch as last time, %u commands, skipping the dup\n", sepol_noop_memo.count);
+		if (res.results)
+			memset(res.results, KSU_SEPOLICY_RESULT_NOOP, min(sepol_noop_memo.count, res.results_len));
+		ret = sepol_noop_memo.count;
+		goto out_unlock;
+	}
+
+	pol = ksu_dup_sepolicy(old_pol);
 	if (IS_ERR(pol)) {
 		ret = PTR_ERR(pol);
 		pr_err("ksu_dup_sepolicy err: %d\n", ret);
 		goto out_unlock;
 	}
-	db = &pol->policydb;
-
-	cursor.cur = payload;
-	cursor.end = payload + (size_t)data_len;
-
-	ret = 0;
-	success_cmd_count = 0;
-	cmd_index = 0;
-	while (cursor.cur < cursor.end) {
-		struct sepol_data header;
-		const char *args[KSU_SEPOLICY_MAX_ARGS] = { 0 };
-		int expected_argc;
-		u32 arg_index;
 
-		ret = sepol_read_cmd_header(&cursor, &header);
-		if (ret < 0) {
-			pr_err("sepol: failed to read cmd header #%u.\n", cmd_index);
-			goto out_drop_new_policy;
-		}
+	ret = sepol_apply_payload(&pol->policydb, payload, (size_t)data_len, &res, true);
+	if (ret < 0)
+		goto out_drop_new_policy;
 
-		expected_argc = sepol_expected_argc(header.cmd);
-		if (expected_argc < 0 || expected_argc > KSU_SEPOLICY_MAX_ARGS) {
-			ret = -EINVAL;
-			pr_err("sepol: invalid cmd header #%u.\n", cmd_index);
-			goto out_drop_new_policy;
-		}
-
-		for (arg_index = 0; arg_index < (u32)expected_argc; arg_index++) {
-			ret = sepol_read_string(&cursor, &args[arg_index]);
-			if (ret < 0) {
-				pr_err("sepol: failed to read cmd #%u arg #%u.\n", cmd_index, arg_index);
-				goto out_drop_new_policy;
-			}
-		}
-
-		ret = apply_one_sepolicy_cmd(db, &header, args);
-		if (ret < 0) {
-			pr_err("sepol: cmd #%u failed, cmd=%u subcmd=%u.\n", cmd_index, header.cmd, header.subcmd);
-		} else {
-			success_cmd_count++;
-			ksu_add_shit_to_list(header.cmd, args);
-		}
-		cmd_index++;
+	// nothing new in this batch, skip the swap and the avc flush
+	if (!res.changed) {
+		pr_info("sepol: batch was a no-op, %d commands\n", ret);
+		if (ret == res.count)
+			sepol_noop_memo_store(old_pol, payload, (size_t)data_len, res.count);
+		goto out_drop_new_policy;
 	}
 
 	rcu_assign_pointer(selinux_state.policy, pol);
+	ksu_policy_swap_gen++;
 	synchronize_rcu();
 	ksu_destroy_sepolicy(old_pol);
 
 	reset_avc_cache();
-	ret = success_cmd_count;
 	goto out_unlock;
 
 out_drop_new_policy:
 	ksu_destroy_sepolicy(pol);
 out_unlock:
 	mutex_unlock(&selinux_state.policy_mutex);
+out_results:
+	ret = sepol_put_results(&res, results, ret);
 out_free:
 	kvfree(payload);
 
@@ -573,34 +1259,50 @@ out_free:
 }
 #else
 
+/*
+ * the policy is patched in place here, with readers locked out (or every cpu
+ * stopped) while it happens, so a batch is applied in chunks of at most
+ * KSU_SEPOLICY_CHUNK_CMDS commands and the exclusive section never grows with
+ * the batch. readers may see a partly applied batch in between, just like
+ * they did when every rule was its own call
+ */
+#define KSU_SEPOLICY_CHUNK_CMDS 64
+
+/*
+ * the exclusive section is dropped between chunks, so this keeps two callers
+ * from interleaving, the type spare arrays and batch state are shared
+ */
+static DEFINE_MUTEX(sepol_apply_mutex);
+
 struct handle_sepolicy_args {
-	void *ctx_success_cmd_count;
-	void *ctx_payload;
-	u64 ctx_data_len;
+	int ctx_success_cmd_count;
+	u32 ctx_cmd_index;
+	u32 ctx_new_types; // types the next chunk adds, their room is prepared outside
+	struct sepol_batch_result *ctx_res;
+	struct sepol_batch_cursor *ctx_cursor; // string table already parsed, advanced per chunk
 };
 
 static int handle_sepolicy_fn(void *data)
 {
-	struct sepol_batch_cursor cursor;
 	int ret = 0;
-	u32 cmd_index = 0;
-	int success_cmd_count = 0;
+	u32 chunk_cmds = 0;
 
 	struct policydb *db = get_policydb();
 	struct handle_sepolicy_args *ctx = (struct handle_sepolicy_args *)data;
-	u8 *payload = (u8 *)ctx->ctx_payload;
-	u64 data_len = ctx->ctx_data_len;
+	struct sepol_batch_cursor *cursor = ctx->ctx_cursor;
 
-	cursor.cur = payload;
-	cursor.end = payload + (size_t)data_len;
+	// a policy load may run between chunks, so the batch state can't outlive one
+	ksu_sepolicy_batch_begin(cursor->interned);
+	ksu_reserve_types(db, ctx->ctx_new_types);
 
-	while (cursor.cur < cursor.end) {
+	while (cursor->cur < cursor->end && chunk_cmds < KSU_SEPOLICY_CHUNK_CMDS) {
+		u32 cmd_index = ctx->ctx_cmd_index;
 		struct sepol_data header;
 		const char *args[KSU_SEPOLICY_MAX_ARGS] = { 0 };
+		struct ksu_sepol_set sets[KSU_SEPOLICY_MAX_ARGS];
 		int expected_argc;
-		u32 arg_index;
 
-		ret = sepol_read_cmd_header(&cursor, &header);
+		ret = sepol_read_cmd_header(cursor, &header);
 		if (ret < 0) {
 			pr_err("sepol: failed to read cmd header #%u.\n", cmd_index);
 			goto out;
@@ -613,36 +1315,37 @@ static int handle_sepolicy_fn(void *data)
 			goto out;
 		}
 
-		for (arg_index = 0; arg_index < (u32)expected_argc; arg_index++) {
-			ret = sepol_read_string(&cursor, &args[arg_index]);
-			if (ret < 0) {
-				pr_err("sepol: failed to read cmd #%u arg #%u.\n", cmd_index, arg_index);
-				goto out;
-			}
-		}
+		ret = sepol_read_args(cursor, &header, (u32)expected_argc, args, sets, cmd_index);
+		if (ret < 0)
+			goto out;
 
-		ret = apply_one_sepolicy_cmd(db, &header, args);
+		// no per command logging, this may run with every cpu stopped
+		ret = apply_one_sepolicy_cmd_tracked(db, &header, args, sets, ctx->ctx_res, cmd_index);
 		if (ret < 0)
 			pr_err("sepol: cmd #%u failed, cmd=%u subcmd=%u.\n", cmd_index, header.cmd, header.subcmd);
 		else {
-			pr_info("sepol: cmd #%u success, cmd=%u subcmd=%u.\n", cmd_index, header.cmd, header.subcmd);
-			success_cmd_count++;
-			ksu_add_shit_to_list(header.cmd, args);
+			ctx->ctx_success_cmd_count++;
+			sepol_track_cmd(&header, args, sets);
 		}
 
-		cmd_index++;
+		ctx->ctx_cmd_index++;
+		chunk_cmds++;
 	}
+	ret = 0;
 
 out:
-	*(int *)(ctx->ctx_success_cmd_count) = success_cmd_count;
+	ksu_sepolicy_batch_end();
 	return ret;
 }
 
-int handle_sepolicy(void __user *user_data, u64 data_len)
+int handle_sepolicy(void __user *user_data, u64 data_len, u8 __user *results, u32 results_len)
 {
+	struct sepol_batch_result res = { 0 };
+	struct sepol_batch_cursor cursor;
 	u8 *payload;
 	int ret = 0;
-	int success_cmd_count = 0;
+	u32 chunks = 0;
+	u64 longest_ns = 0;
 
 	if (!user_data || !data_len)
     		return -EINVAL;
@@ -659,47 +1362,89 @@ int handle_sepolicy(void __user *user_data, u64 data_len)
 		goto out_free;
 	}
 
+	if (sepol_is_v2_probe(payload, (size_t)data_len))
+		goto out_free;
+
+	// parse the string table out here, the apply below may run atomic
+	ret = sepol_cursor_init(&cursor, payload, (size_t)data_len);
+	if (ret < 0)
+		goto out_free;
+
+	ret = sepol_alloc_results(&res, results, results_len);
+	if (ret < 0)
+		goto out_release;
+
 	if (!getenforce()) {
 		pr_info("SELinux permissive or disabled when handle policy!\n");
 	}
 
 	struct handle_sepolicy_args ctx = { 0 };
-	ctx.ctx_success_cmd_count = (void *)&success_cmd_count;
-	ctx.ctx_payload = (void *)payload;
-	ctx.ctx_data_len = (u64)data_len;
+	ctx.ctx_res = &res;
+	ctx.ctx_cursor = &cursor;
 
 	rwlock_t *lock = ksu_get_policy_rwlock();
-	if (!lock)
-		goto do_stop_machine;
-
 	cpumask_t old_mask;
-	cpumask_copy(&old_mask, ksu_get_current_cpumask_t());
-	set_cpus_allowed_ptr(current, cpumask_of(raw_smp_processor_id()));
+	if (lock) {
+		cpumask_copy(&old_mask, ksu_get_current_cpumask_t());
+		set_cpus_allowed_ptr(current, cpumask_of(raw_smp_processor_id()));
+	}
 
-	write_lock(lock);
-	preempt_enable();
+	mutex_lock(&sepol_apply_mutex);
+	do {
+		u64 start;
 
-	ret = handle_sepolicy_fn((void *)&ctx);
+		// allocate the type arrays out here, the chunk may run with every cpu stopped
+		ctx.ctx_new_types = sepol_count_new_types(cursor, KSU_SEPOLICY_CHUNK_CMDS);
+		ksu_prepare_types(get_policydb(), ctx.ctx_new_types);
 
-	preempt_disable();
-	write_unlock(lock);
-	set_cpus_allowed_ptr(current, &old_mask);
-	goto out_done;
+		start = ktime_get_ns();
+		if (lock) {
+			write_lock(lock);
+			preempt_enable();
 
-do_stop_machine:
-	ret = stop_machine(handle_sepolicy_fn, (void *)&ctx, NULL);
+			ret = handle_sepolicy_fn((void *)&ctx);
 
-out_done:
-	if (ret)
-		goto out_free;
+			preempt_disable();
+			write_unlock(lock);
+		} else {
+			ret = stop_machine(handle_sepolicy_fn, (void *)&ctx, NULL);
+		}
+		longest_ns = max_t(u64, longest_ns, ktime_get_ns() - start);
 
-	smp_mb();
-	reset_avc_cache();
-	ret = success_cmd_count;
+		// the arrays the chunk replaced, or the spare ones if it needed none
+		ksu_release_types();
+		chunks++;
+		cond_resched();
+	} while (!ret && cursor.cur < cursor.end);
+	mutex_unlock(&sepol_apply_mutex);
+
+	if (lock)
+		set_cpus_allowed_ptr(current, &old_mask);
+
+	pr_info("sepol: %u cmds in %u %s sections, longest %llu us\n", ctx.ctx_cmd_index, chunks,
+		lock ? "policy_rwlock" : "stop_machine", div_u64(longest_ns, NSEC_PER_USEC));
 
+	// chunks before a malformed command are already in, flush them too
+	smp_mb();
+	if (res.changed)
+		reset_avc_cache();
+	if (!ret)
+		ret = ctx.ctx_success_cmd_count;
+
+	ret = sepol_put_results(&res, results, ret);
+out_release:
+	sepol_cursor_release(&cursor);
 out_free:
 	kvfree(payload);
 
 	return ret;
 }
+
+// transactions need a private policy copy, which only exists on >= 5.10
+int handle_sepolicy_txn(u32 op)
+{
+	return -EOPNOTSUPP;
+}
+
+void ksu_sepolicy_txn_release(void) { }
 #endif
@@ -15,6 +15,126 @@ static u32 cached_zygote_sid __read_mostly = 0;
 static u32 cached_init_sid __read_mostly = 0;
 u32 ksu_file_sid __read_mostly = 0;
 
+/*
+ * domain string -> SID for root profile transitions
+ * every grant used to parse the context and look it up in the policy, now
+ * that happens once per domain and policy generation. the table is copied on
+ * write and read under rcu, a policy load or any change of ours to the policy
+ * moves the generation and retires the whole table
+ */
+#define KSU_DOMAIN_SID_CACHE_SIZE 16
+
+struct domain_sid_entry {
+	char domain[KSU_SELINUX_DOMAIN];
+	u32 sid;
+};
+
+struct domain_sid_cache {
+	struct rcu_head rcu;
+	unsigned long changes; // ksu_sepolicy_changes()
+	u32 seqno; // policy latest_granting
+	u32 count;
+	u32 next; // slot to replace once full
+	struct domain_sid_entry entries[KSU_DOMAIN_SID_CACHE_SIZE];
+};
+
+static struct domain_sid_cache __rcu *domain_sid_cache;
+static DEFINE_MUTEX(domain_sid_cache_mutex);
+
+// moves on every policy load
+static u32 ksu_policy_seqno(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+	struct selinux_policy *policy;
+	u32 seqno = 0;
+
+	rcu_read_lock();
+	policy = rcu_dereference(selinux_state.policy);
+	if (policy)
+		seqno = policy->latest_granting;
+	rcu_read_unlock();
+	return seqno;
+#elif defined(KSU_COMPAT_USE_SELINUX_STATE)
+	return READ_ONCE(selinux_state.ss->latest_granting);
+#else
+	// not reachable here, sids survive a reload anyway, only our own changes count
+	return 0;
+#endif
+}
+
+static int domain_to_sid(const char *domain, u32 *sid)
+{
+	unsigned long changes = ksu_sepolicy_changes();
+	u32 seqno = ksu_policy_seqno();
+	struct domain_sid_cache *cache, *new_cache;
+	u32 i;
+	int error;
+
+	rcu_read_lock();
+	cache = rcu_dereference(domain_sid_cache);
+	if (cache && cache->changes == changes && cache->seqno == seqno) {
+		for (i = 0; i < cache->count; i++) {
+			if (strcmp(cache->entries[i].domain, domain) == 0) {
+				*sid = cache->entries[i].sid;
+				rcu_read_unlock();
+				return 0;
+			}
+		}
+	}
+	rcu_read_unlock();
+
+	// the generation was read first, a policy change from here on retires the entry
+	error = security_secctx_to_secid(domain, strlen(domain), sid);
+	if (error || strlen(domain) >= KSU_SELINUX_DOMAIN)
+		return error;
+
+	new_cache = kmalloc(sizeof(*new_cache), GFP_KERNEL);
+	if (!new_cache)
+		return 0;
+
+	mutex_lock(&domain_sid_cache_mutex);
+	cache = rcu_dereference_protected(domain_sid_cache, lockdep_is_held(&domain_sid_cache_mutex));
+	if (cache && cache->changes == changes && cache->seqno == seqno) {
+		memcpy(new_cache, cache, sizeof(*new_cache));
+		for (i = 0; i < new_cache->count; i++) {
+			// raced with another grant of the same domain
+			if (strcmp(new_cache->entries[i].domain, domain) == 0) {
+				mutex_unlock(&domain_sid_cache_mutex);
+				kfree(new_cache);
+				return 0;
+			}
+		}
+	} else {
+		memset(new_cache, 0, sizeof(*new_cache));
+		new_cache->changes = changes;
+		new_cache->seqno = seqno;
+	}
+
+	if (new_cache->count < KSU_DOMAIN_SID_CACHE_SIZE) {
+		i = new_cache->count++;
+	} else {
+		i = new_cache->next;
+		new_cache->next = (new_cache->next + 1) % KSU_DOMAIN_SID_CACHE_SIZE;
+	}
+	strscpy(new_cache->entries[i].domain, domain, KSU_SELINUX_DOMAIN);
+	new_cache->entries[i].sid = *sid;
+
+	rcu_assign_pointer(domain_sid_cache, new_cache);
+	mutex_unlock(&domain_sid_cache_mutex);
+	if (cache)
+		kfree_rcu(cache, rcu);
+	return 0;
+}
+
+void ksu_cache_domain_sid(const char *domain)
+{
+	u32 sid;
+	int err = domain_to_sid(domain, &sid);
+
+	if (err)
+		pr_warn("Failed to cache SID of %s: %d\n", domain, err);
+}
+
 static int transive_to_domain(const char *domain, struct cred *cred, bool clear_exec_sid)
 {
 	u32 sid;
@@ -29,7 +149,7 @@ static int transive_to_domain(const char *domain, struct cred *cred, bool clear_
 		pr_err("tsec == NULL!\n");
 		return -1;
 	}
-	error = security_secctx_to_secid(domain, strlen(domain), &sid);
+	error = domain_to_sid(domain, &sid);
 	if (error) {
 		pr_info("security_secctx_to_secid %s -> sid: %d, error: %d\n", domain,
 				sid, error);
@@ -156,6 +276,9 @@ void cache_sid(void)
 	} else {
 		pr_info("Cached ksu_file SID: %u\n", ksu_file_sid);
 	}
+
+	// the default root profile domain, custom ones come with the allowlist
+	ksu_cache_domain_sid(KERNEL_SU_CONTEXT);
 }
 
 /*
@@ -21,6 +21,9 @@ bool getenforce();
 
 void cache_sid(void);
 
+// resolve a root profile domain ahead of its first grant
+void ksu_cache_domain_sid(const char *domain);
+
 bool is_task_ksu_domain(const struct cred* cred);
 
 bool is_ksu_domain();
@@ -31,7 +34,12 @@ bool is_init(const struct cred* cred);
 
 void apply_kernelsu_rules();
 
-int handle_sepolicy(void __user *user_data, u64 data_len);
+int handle_sepolicy(void __user *user_data, u64 data_len, u8 __user *results, u32 results_len);
+
+int handle_sepolicy_txn(u32 op);
+
+// driver fd release hook, drops an abandoned transaction
+void ksu_sepolicy_txn_release(void);
 
 void setup_ksu_cred();
 
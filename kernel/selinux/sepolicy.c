@@ -30,6 +30,10 @@ static bool add_rule(struct policydb *db, const char *s, const char *t, const ch
 
 static bool add_rule_raw(struct policydb *db, struct type_datum *src, struct type_datum *tgt, struct class_datum *cls,
 				struct perm_datum *perm, int effect, bool invert);
+static bool add_rule_mask_raw(struct policydb *db, struct type_datum *src, struct type_datum *tgt,
+				struct class_datum *cls, u32 mask, int effect, bool invert);
+static bool add_rule_set(struct policydb *db, const struct ksu_sepol_set *s, const struct ksu_sepol_set *t,
+				const struct ksu_sepol_set *c, const struct ksu_sepol_set *p, int effect, bool invert);
 
 static void add_xperm_rule_raw(struct policydb *db, struct type_datum *src, struct type_datum *tgt,
 				struct class_datum *cls, uint16_t low, uint16_t high, int effect, bool invert);
@@ -81,6 +85,92 @@ static bool add_typeattribute(struct policydb *db, const char *type, const char
 
 #define avtab_for_each(avtab, cur) ksu_hash_for_each(avtab.htable, avtab.nslot, cur)
 
+/*
+ * bumped whenever a mutator actually changes the policy
+ * callers compare it around a command to tell a no-op (rule already there)
+ * from a real change, all mutation is serialized by the policy locks
+ * it counts net changes, an avtab node inserted and removed again within
+ * the same rule leaves it untouched
+ */
+static unsigned long ksu_policy_changes = 0;
+
+unsigned long ksu_sepolicy_changes(void)
+{
+	return ksu_policy_changes;
+}
+
+/*
+ * name -> datum memo for one v2 batch
+ * v2 interns the arguments, so all uses of a name share one pointer and the
+ * symtab lookup is done once per batch, keyed by (name, symtab) pointers
+ * only hits are kept, a type missing now may be added later in the batch
+ */
+#define KSU_SEPOL_MEMO_BITS 9
+
+struct sepol_memo_entry {
+	const char *name;
+	struct symtab *tab;
+	void *datum;
+};
+
+static struct sepol_memo_entry ksu_sepol_memo[1 << KSU_SEPOL_MEMO_BITS];
+static bool ksu_sepol_memo_active = false;
+
+/*
+ * spare slots at the end of the type arrays
+ * add_type only grows them when they are full, but a fresh policy copy has
+ * exactly nprim slots and the arrays may be freed behind our back once the
+ * write side is dropped, so the record is only trusted inside one batch
+ */
+struct sepol_type_room {
+	struct policydb *db;
+	void *attr_map;
+	void *val_to_struct;
+	void *val_to_name;
+	u32 slots;
+};
+
+static struct sepol_type_room ksu_type_room;
+static bool ksu_sepol_batch_active = false;
+
+void ksu_sepolicy_batch_begin(bool interned)
+{
+	if (interned) {
+		memset(ksu_sepol_memo, 0, sizeof(ksu_sepol_memo));
+		ksu_sepol_memo_active = true;
+	}
+	memset(&ksu_type_room, 0, sizeof(ksu_type_room));
+	ksu_sepol_batch_active = true;
+}
+
+// the names die with the batch payload
+void ksu_sepolicy_batch_end(void)
+{
+	ksu_sepol_memo_active = false;
+	ksu_sepol_batch_active = false;
+}
+
+static void *sepol_search(struct symtab *tab, const char *name)
+{
+	struct sepol_memo_entry *entry;
+	void *datum;
+
+	if (!ksu_sepol_memo_active)
+		return symtab_search(tab, name);
+
+	entry = &ksu_sepol_memo[hash_ptr((void *)((unsigned long)name ^ (unsigned long)tab), KSU_SEPOL_MEMO_BITS)];
+	if (entry->name == name && entry->tab == tab)
+		return entry->datum;
+
+	datum = symtab_search(tab, name);
+	if (datum) {
+		entry->name = name;
+		entry->tab = tab;
+		entry->datum = datum;
+	}
+	return datum;
+}
+
 static struct avtab_node *get_avtab_node(struct policydb *db,
 					 struct avtab_key *key,
 					 struct avtab_extended_perms *xperms)
@@ -122,6 +212,7 @@ static struct avtab_node *get_avtab_node(struct policydb *db,
 		node = avtab_insert_nonunique(&db->te_avtab, key, &avdatum);
 		if (!node)
 			return NULL;
+		ksu_policy_changes++;
 
 		int grow_size = sizeof(struct avtab_key);
 		grow_size += sizeof(struct avtab_datum);
@@ -214,6 +305,7 @@ static bool remove_avtab_node(struct policydb *db, struct avtab_node *node)
 			avtab_destroy(&removed);
 			if (db->len >= shrink_size)
 				db->len -= shrink_size;
+			ksu_policy_changes++;
 			return true;
 		}
 	}
@@ -230,7 +322,7 @@ static bool add_rule(struct policydb *db, const char *s, const char *t, const ch
 	struct perm_datum *perm = NULL;
 
 	if (s) {
-		src = symtab_search(&db->p_types, s);
+		src = sepol_search(&db->p_types, s);
 		if (src == NULL) {
 			pr_info("source type %s does not exist\n", s);
 			return false;
@@ -238,7 +330,7 @@ static bool add_rule(struct policydb *db, const char *s, const char *t, const ch
 	}
 
 	if (t) {
-		tgt = symtab_search(&db->p_types, t);
+		tgt = sepol_search(&db->p_types, t);
 		if (tgt == NULL) {
 			pr_info("target type %s does not exist\n", t);
 			return false;
@@ -246,7 +338,7 @@ static bool add_rule(struct policydb *db, const char *s, const char *t, const ch
 	}
 
 	if (c) {
-		cls = symtab_search(&db->p_classes, c);
+		cls = sepol_search(&db->p_classes, c);
 		if (cls == NULL) {
 			pr_info("class %s does not exist\n", c);
 			return false;
@@ -260,9 +352,9 @@ static bool add_rule(struct policydb *db, const char *s, const char *t, const ch
 			return false;
 		}
 
-		perm = symtab_search(&cls->permissions, p);
+		perm = sepol_search(&cls->permissions, p);
 		if (perm == NULL && cls->comdatum != NULL) {
-			perm = symtab_search(&cls->comdatum->permissions, p);
+			perm = sepol_search(&cls->comdatum->permissions, p);
 		}
 		if (perm == NULL) {
 			pr_info("perm %s does not exist in class %s\n", p, c);
@@ -274,6 +366,13 @@ static bool add_rule(struct policydb *db, const char *s, const char *t, const ch
 
 static bool add_rule_raw(struct policydb *db, struct type_datum *src, struct type_datum *tgt, struct class_datum *cls,
 						 struct perm_datum *perm, int effect, bool invert)
+{
+	return add_rule_mask_raw(db, src, tgt, cls, perm ? 1U << (perm->value - 1) : ~0U, effect, invert);
+}
+
+// mask is the av bits to set (or clear with invert), ~0U for all perms
+static bool add_rule_mask_raw(struct policydb *db, struct type_datum *src, struct type_datum *tgt,
+			      struct class_datum *cls, u32 mask, int effect, bool invert)
 {
 	bool success = true;
 
@@ -282,14 +381,14 @@ static bool add_rule_raw(struct policydb *db, struct type_datum *src, struct typ
 		if (strip_av(effect, invert)) {
 			ksu_hashtab_for_each(db->p_types.table, node)
 			{
-				success &= add_rule_raw(db, (struct type_datum *)node->datum, tgt, cls, perm, effect, invert);
+				success &= add_rule_mask_raw(db, (struct type_datum *)node->datum, tgt, cls, mask, effect, invert);
 			};
 		} else {
 			ksu_hashtab_for_each(db->p_types.table, node)
 			{
 				struct type_datum *type = (struct type_datum *)(node->datum);
 				if (type->attribute) {
-					success &= add_rule_raw(db, type, tgt, cls, perm, effect, invert);
+					success &= add_rule_mask_raw(db, type, tgt, cls, mask, effect, invert);
 				}
 			};
 		}
@@ -298,14 +397,14 @@ static bool add_rule_raw(struct policydb *db, struct type_datum *src, struct typ
 		if (strip_av(effect, invert)) {
 			ksu_hashtab_for_each(db->p_types.table, node)
 			{
-				success &= add_rule_raw(db, src, (struct type_datum *)node->datum, cls, perm, effect, invert);
+				success &= add_rule_mask_raw(db, src, (struct type_datum *)node->datum, cls, mask, effect, invert);
 			};
 		} else {
 			ksu_hashtab_for_each(db->p_types.table, node)
 			{
 				struct type_datum *type = (struct type_datum *)(node->datum);
 				if (type->attribute) {
-					success &= add_rule_raw(db, src, type, cls, perm, effect, invert);
+					success &= add_rule_mask_raw(db, src, type, cls, mask, effect, invert);
 				}
 			};
 		}
@@ -313,11 +412,12 @@ static bool add_rule_raw(struct policydb *db, struct type_datum *src, struct typ
 		struct hashtab_node *node;
 		ksu_hashtab_for_each(db->p_classes.table, node)
 		{
-			success &= add_rule_raw(db, src, tgt, (struct class_datum *)node->datum, perm, effect, invert);
+			success &= add_rule_mask_raw(db, src, tgt, (struct class_datum *)node->datum, mask, effect, invert);
 		}
 	} else {
 		struct avtab_key key;
 		struct avtab_node *node;
+		unsigned long changes = ksu_policy_changes;
 
 		key.source_type = src->value;
 		key.target_type = tgt->value;
@@ -333,20 +433,106 @@ static bool add_rule_raw(struct policydb *db, struct type_datum *src, struct typ
 			if (!node)
 				return false;
 		}
+		bool inserted = ksu_policy_changes != changes;
+
+		u32 old_data = node->datum.u.data;
+		if (invert)
+			node->datum.u.data &= ~mask;
+		else
+			node->datum.u.data |= mask;
+		if (node->datum.u.data != old_data)
+			ksu_policy_changes++;
+		if (is_redundant_avtab_node(node)) {
+			bool removed = remove_avtab_node(db, node);
+
+			// created just to be dropped again, the policy is as it was
+			if (removed && inserted)
+				ksu_policy_changes = changes;
+			return removed;
+		}
+	}
 
-		if (invert) {
-			if (perm)
-				node->datum.u.data &= ~(1U << (perm->value - 1));
-			else
-				node->datum.u.data = 0U;
-		} else {
-			if (perm)
-				node->datum.u.data |= 1U << (perm->value - 1);
-			else
-				node->datum.u.data = ~0U;
+	return success;
+}
+
+/*
+ * set form of add_rule: each class is resolved once together with the mask of
+ * all requested perms, then every (src, tgt, cls) avtab node is updated once,
+ * instead of once per perm as the flattened form does
+ * names resolve through the batch memo, so repeated types cost one lookup
+ */
+static bool add_rule_set(struct policydb *db, const struct ksu_sepol_set *s, const struct ksu_sepol_set *t,
+			 const struct ksu_sepol_set *c, const struct ksu_sepol_set *p, int effect, bool invert)
+{
+	bool success = true;
+	u32 ci, si, ti, pi;
+
+	if (!c->count && p->count) {
+		pr_info("No class is specified, cannot add perms\n");
+		return false;
+	}
+
+	for (ci = 0; ci < max(c->count, 1U); ci++) {
+		struct class_datum *cls = NULL;
+		u32 mask = ~0U;
+
+		if (c->count) {
+			const char *name = ksu_sepol_set_name(c, ci);
+
+			cls = sepol_search(&db->p_classes, name);
+			if (cls == NULL) {
+				pr_info("class %s does not exist\n", name);
+				success = false;
+				continue;
+			}
+		}
+
+		if (p->count) {
+			mask = 0;
+			for (pi = 0; pi < p->count; pi++) {
+				const char *name = ksu_sepol_set_name(p, pi);
+				struct perm_datum *perm = sepol_search(&cls->permissions, name);
+
+				if (perm == NULL && cls->comdatum != NULL)
+					perm = sepol_search(&cls->comdatum->permissions, name);
+				if (perm == NULL) {
+					pr_info("perm %s does not exist in class %s\n", name, ksu_sepol_set_name(c, ci));
+					success = false;
+					continue;
+				}
+				mask |= 1U << (perm->value - 1);
+			}
+			if (!mask)
+				continue;
+		}
+
+		for (si = 0; si < max(s->count, 1U); si++) {
+			struct type_datum *src = NULL;
+
+			if (s->count) {
+				src = sepol_search(&db->p_types, ksu_sepol_set_name(s, si));
+				if (src == NULL) {
+					pr_info("source type %s does not exist\n", ksu_sepol_set_name(s, si));
+					success = false;
+					continue;
+				}
+			}
+
+			for (ti = 0; ti < max(t->count, 1U); ti++) {
+				struct type_datum *tgt = NULL;
+
+				if (t->count) {
+					tgt = sepol_search(&db->p_types, ksu_sepol_set_name(t, ti));
+					if (tgt == NULL) {
+						pr_info("target type %s does not exist\n", ksu_sepol_set_name(t, ti));
+						success = false;
+						continue;
+					}
+				}
+
+				success &= add_rule_mask_raw(db, src, tgt, cls, mask, effect, invert);
+			}
 		}
-		if (is_redundant_avtab_node(node))
-			return remove_avtab_node(db, node);
 	}
 
 	return success;
@@ -436,6 +622,7 @@ static void add_xperm_rule_raw(struct policydb *db, struct type_datum *src, stru
 				return;
 			}
 			memcpy(datum->u.xperms, &xperms, sizeof(xperms));
+			ksu_policy_changes++;
 		}
 	}
 }
@@ -447,7 +634,7 @@ static bool add_xperm_rule(struct policydb *db, const char *s, const char *t, co
 	struct class_datum *cls = NULL;
 
 	if (s) {
-		src = symtab_search(&db->p_types, s);
+		src = sepol_search(&db->p_types, s);
 		if (src == NULL) {
 			pr_info("source type %s does not exist\n", s);
 			return false;
@@ -455,7 +642,7 @@ static bool add_xperm_rule(struct policydb *db, const char *s, const char *t, co
 	}
 
 	if (t) {
-		tgt = symtab_search(&db->p_types, t);
+		tgt = sepol_search(&db->p_types, t);
 		if (tgt == NULL) {
 			pr_info("target type %s does not exist\n", t);
 			return false;
@@ -463,7 +650,7 @@ static bool add_xperm_rule(struct policydb *db, const char *s, const char *t, co
 	}
 
 	if (c) {
-		cls = symtab_search(&db->p_classes, c);
+		cls = sepol_search(&db->p_classes, c);
 		if (cls == NULL) {
 			pr_info("class %s does not exist\n", c);
 			return false;
@@ -493,22 +680,22 @@ static bool add_type_rule(struct policydb *db, const char *s, const char *t, con
 	struct type_datum *src, *tgt, *def;
 	struct class_datum *cls;
 
-	src = symtab_search(&db->p_types, s);
+	src = sepol_search(&db->p_types, s);
 	if (src == NULL) {
 		pr_info("source type %s does not exist\n", s);
 		return false;
 	}
-	tgt = symtab_search(&db->p_types, t);
+	tgt = sepol_search(&db->p_types, t);
 	if (tgt == NULL) {
 		pr_info("target type %s does not exist\n", t);
 		return false;
 	}
-	cls = symtab_search(&db->p_classes, c);
+	cls = sepol_search(&db->p_classes, c);
 	if (cls == NULL) {
 		pr_info("class %s does not exist\n", c);
 		return false;
 	}
-	def = symtab_search(&db->p_types, d);
+	def = sepol_search(&db->p_types, d);
 	if (def == NULL) {
 		pr_info("default type %s does not exist\n", d);
 		return false;
@@ -523,7 +710,10 @@ static bool add_type_rule(struct policydb *db, const char *s, const char *t, con
 	struct avtab_node *node = get_avtab_node(db, &key, NULL);
 	if (!node)
 		return false;
-	node->datum.u.data = def->value;
+	if (node->datum.u.data != def->value) {
+		node->datum.u.data = def->value;
+		ksu_policy_changes++;
+	}
 
 	return true;
 }
@@ -577,22 +767,22 @@ static bool add_filename_trans(struct policydb *db, const char *s,
 	struct type_datum *src, *tgt, *def;
 	struct class_datum *cls;
 
-	src = symtab_search(&db->p_types, s);
+	src = sepol_search(&db->p_types, s);
 	if (src == NULL) {
 		pr_warn("source type %s does not exist\n", s);
 		return false;
 	}
-	tgt = symtab_search(&db->p_types, t);
+	tgt = sepol_search(&db->p_types, t);
 	if (tgt == NULL) {
 		pr_warn("target type %s does not exist\n", t);
 		return false;
 	}
-	cls = symtab_search(&db->p_classes, c);
+	cls = sepol_search(&db->p_classes, c);
 	if (cls == NULL) {
 		pr_warn("class %s does not exist\n", c);
 		return false;
 	}
-	def = symtab_search(&db->p_types, d);
+	def = sepol_search(&db->p_types, d);
 	if (def == NULL) {
 		pr_warn("default type %s does not exist\n", d);
 		return false;
@@ -614,7 +804,10 @@ static bool add_filename_trans(struct policydb *db, const char *s,
 	while (trans) {
 		if (ebitmap_get_bit(&trans->stypes, src->value - 1)) {
 			// Duplicate, overwrite existing data and return
-			trans->otype = def->value;
+			if (trans->otype != def->value) {
+				trans->otype = def->value;
+				ksu_policy_changes++;
+			}
 			return true;
 		}
 		if (trans->otype == def->value)
@@ -634,6 +827,7 @@ static bool add_filename_trans(struct policydb *db, const char *s,
 	}
 
 	db->compat_filename_trans_count++;
+	ksu_policy_changes++;
 	return ebitmap_set_bit(&trans->stypes, src->value - 1, 1) == 0;
 #else // < 5.7.0, has no filename_trans_key, but struct filename_trans
 
@@ -661,8 +855,13 @@ static bool add_filename_trans(struct policydb *db, const char *s,
 		new_key->name = kstrdup(key.name, GFP_KERNEL);
 		trans->otype = def->value;
 		hashtab_insert(db->filename_trans, new_key, trans);
+		ksu_policy_changes++;
 	}
 
+	if (ebitmap_get_bit(&db->filename_trans_ttypes, src->value - 1))
+		return true;
+
+	ksu_policy_changes++;
 	return ebitmap_set_bit(&db->filename_trans_ttypes, src->value - 1, 1) == 0;
 #endif
 }
@@ -694,124 +893,161 @@ static void *ksu_kvrealloc_compat(const void *p, size_t oldsize, size_t newsize,
 #define ksu_kvrealloc(p, new_size, old_size) ksu_kvrealloc_compat(p, old_size, new_size, GFP_KERNEL)
 #endif
 
-static bool add_type(struct policydb *db, const char *type_name, bool attr)
-{
-#ifdef KSU_SUPPORT_ADD_TYPE
-	struct type_datum *type = symtab_search(&db->p_types, type_name);
-	if (type) {
-		pr_warn("Type %s already exists\n", type_name);
-		return true;
-	}
-
-	u32 value = ++db->p_types.nprim;
-	type = (struct type_datum *)kzalloc(sizeof(struct type_datum),
-					    GFP_KERNEL);
-	if (!type) {
-		pr_err("add_type: alloc type_datum failed.\n");
-		return false;
-	}
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 4, 0) || defined(KSU_TYPE_VAL_TO_STRUCT)
+#define KSU_TYPE_ARRAYS_KVREALLOC
+#define ksu_type_val_to_struct(db) ((db)->type_val_to_struct)
+#elif defined(KSU_TYPE_VAL_TO_STRUCT_ARRAY)
+#define KSU_TYPE_ARRAYS_KVREALLOC
+#define ksu_type_val_to_struct(db) ((db)->type_val_to_struct_array)
+#endif
 
-	type->primary = 1;
-	type->value = value;
-	type->attribute = attr;
+#ifdef KSU_TYPE_ARRAYS_KVREALLOC
+/*
+ * type arrays allocated by ksu_prepare_types before an atomic apply
+ * ksu_reserve_types swaps them in and parks the replaced ones here, so
+ * nothing is allocated or freed with every cpu stopped
+ */
+struct sepol_type_spare {
+	void *attr_map;
+	void *val_to_struct;
+	void *val_to_name;
+	u32 slots;
+	bool parked; // holds the replaced arrays, not free room
+};
 
-	char *key = kstrdup(type_name, GFP_KERNEL);
-	if (!key) {
-		pr_err("add_type: alloc key failed.\n");
-		return false;
-	}
+static struct sepol_type_spare ksu_type_spare;
 
-	if (symtab_insert(&db->p_types, key, type)) {
-		pr_err("add_type: insert symtab failed.\n");
-		return false;
-	}
+// slots the type arrays of db hold, used if nothing is known about them
+static u32 type_arrays_slots(struct policydb *db, u32 used)
+{
+	if (ksu_sepol_batch_active && ksu_type_room.db == db && ksu_type_room.attr_map == db->type_attr_map_array &&
+	    ksu_type_room.val_to_struct == ksu_type_val_to_struct(db) &&
+	    ksu_type_room.val_to_name == db->sym_val_to_name[SYM_TYPES])
+		return ksu_type_room.slots;
+	return used;
+}
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 4, 0) || defined(KSU_TYPE_VAL_TO_STRUCT)
+// resize the type arrays to slots entries, only the first used ones are copied
+static bool grow_type_arrays(struct policydb *db, u32 used, u32 slots)
+{
 	struct ebitmap *new_type_attr_map_array =
-		ksu_kvrealloc(db->type_attr_map_array,
-			    value * sizeof(struct ebitmap),
-			    (value - 1) * sizeof(struct ebitmap));
-
+		ksu_kvrealloc(db->type_attr_map_array, slots * sizeof(struct ebitmap), used * sizeof(struct ebitmap));
 	if (!new_type_attr_map_array) {
 		pr_err("add_type: alloc type_attr_map_array failed\n");
 		return false;
 	}
+	db->type_attr_map_array = new_type_attr_map_array;
 
 	struct type_datum **new_type_val_to_struct =
-		ksu_kvrealloc(db->type_val_to_struct,
-			    sizeof(*db->type_val_to_struct) * value,
-			    sizeof(*db->type_val_to_struct) * (value - 1));
-
+		ksu_kvrealloc(ksu_type_val_to_struct(db), slots * sizeof(struct type_datum *),
+			      used * sizeof(struct type_datum *));
 	if (!new_type_val_to_struct) {
 		pr_err("add_type: alloc type_val_to_struct failed\n");
 		return false;
 	}
+	ksu_type_val_to_struct(db) = new_type_val_to_struct;
 
 	char **new_val_to_name_types =
-		ksu_kvrealloc(db->sym_val_to_name[SYM_TYPES],
-			    sizeof(char *) * value,
-			    sizeof(char *) * (value - 1));
+		ksu_kvrealloc(db->sym_val_to_name[SYM_TYPES], slots * sizeof(char *), used * sizeof(char *));
 	if (!new_val_to_name_types) {
 		pr_err("add_type: alloc val_to_name failed\n");
 		return false;
 	}
+	db->sym_val_to_name[SYM_TYPES] = new_val_to_name_types;
 
-	db->type_attr_map_array = new_type_attr_map_array;
-	ebitmap_init(&db->type_attr_map_array[value - 1]);
-	ebitmap_set_bit(&db->type_attr_map_array[value - 1], value - 1, 1);
+	if (ksu_sepol_batch_active) {
+		ksu_type_room.db = db;
+		ksu_type_room.attr_map = db->type_attr_map_array;
+		ksu_type_room.val_to_struct = ksu_type_val_to_struct(db);
+		ksu_type_room.val_to_name = db->sym_val_to_name[SYM_TYPES];
+		ksu_type_room.slots = slots;
+	}
+	return true;
+}
 
-	db->type_val_to_struct = new_type_val_to_struct;
-	db->type_val_to_struct[value - 1] = type;
+// move the type arrays into the spare ones, false if there are none big enough
+static bool take_type_spare(struct policydb *db, u32 used, u32 slots)
+{
+	struct sepol_type_spare *spare = &ksu_type_spare;
+	void *attr_map, *val_to_struct, *val_to_name;
 
-	db->sym_val_to_name[SYM_TYPES] = new_val_to_name_types;
-	db->sym_val_to_name[SYM_TYPES][value - 1] = key;
+	if (!spare->attr_map || spare->parked || spare->slots < slots)
+		return false;
 
-	int i;
-	for (i = 0; i < db->p_roles.nprim; ++i) {
-		ebitmap_set_bit(&db->role_val_to_struct[i]->types, value - 1,
-				1);
-	}
+	attr_map = db->type_attr_map_array;
+	val_to_struct = ksu_type_val_to_struct(db);
+	val_to_name = db->sym_val_to_name[SYM_TYPES];
+
+	__builtin_memcpy(spare->attr_map, attr_map, used * sizeof(struct ebitmap));
+	__builtin_memcpy(spare->val_to_struct, val_to_struct, used * sizeof(struct type_datum *));
+	__builtin_memcpy(spare->val_to_name, val_to_name, used * sizeof(char *));
 
+	db->type_attr_map_array = spare->attr_map;
+	ksu_type_val_to_struct(db) = spare->val_to_struct;
+	db->sym_val_to_name[SYM_TYPES] = spare->val_to_name;
+
+	ksu_type_room.db = db;
+	ksu_type_room.attr_map = db->type_attr_map_array;
+	ksu_type_room.val_to_struct = ksu_type_val_to_struct(db);
+	ksu_type_room.val_to_name = db->sym_val_to_name[SYM_TYPES];
+	ksu_type_room.slots = spare->slots;
+
+	spare->attr_map = attr_map;
+	spare->val_to_struct = val_to_struct;
+	spare->val_to_name = val_to_name;
+	spare->parked = true;
 	return true;
+}
+#endif
 
-#elif defined(KSU_TYPE_VAL_TO_STRUCT_ARRAY)
-	struct ebitmap *new_type_attr_map_array =
-		ksu_kvrealloc(db->type_attr_map_array,
-			    value * sizeof(struct ebitmap),
-			    (value - 1) * sizeof(struct ebitmap));
+static bool add_type(struct policydb *db, const char *type_name, bool attr)
+{
+#ifdef KSU_SUPPORT_ADD_TYPE
+	struct type_datum *type = sepol_search(&db->p_types, type_name);
+	if (type) {
+		pr_warn("Type %s already exists\n", type_name);
+		return true;
+	}
 
-	if (!new_type_attr_map_array) {
-		pr_err("add_type: alloc type_attr_map_array failed\n");
+	ksu_policy_changes++;
+	u32 value = ++db->p_types.nprim;
+	type = (struct type_datum *)kzalloc(sizeof(struct type_datum),
+					    GFP_KERNEL);
+	if (!type) {
+		pr_err("add_type: alloc type_datum failed.\n");
 		return false;
 	}
 
-	struct type_datum **new_type_val_to_struct =
-		ksu_kvrealloc(db->type_val_to_struct_array,
-			    sizeof(*db->type_val_to_struct_array) * value,
-			    sizeof(*db->type_val_to_struct_array) * (value - 1));
+	type->primary = 1;
+	type->value = value;
+	type->attribute = attr;
 
-	if (!new_type_val_to_struct) {
-		pr_err("add_type: alloc type_val_to_struct failed\n");
+	char *key = kstrdup(type_name, GFP_KERNEL);
+	if (!key) {
+		pr_err("add_type: alloc key failed.\n");
 		return false;
 	}
 
-	char **new_val_to_name_types =
-		ksu_kvrealloc(db->sym_val_to_name[SYM_TYPES],
-			    sizeof(char *) * value,
-			    sizeof(char *) * (value - 1));
-	if (!new_val_to_name_types) {
-		pr_err("add_type: alloc val_to_name failed\n");
+	if (symtab_insert(&db->p_types, key, type)) {
+		pr_err("add_type: insert symtab failed.\n");
 		return false;
 	}
 
-	db->type_attr_map_array = new_type_attr_map_array;
+#ifdef KSU_TYPE_ARRAYS_KVREALLOC
+	if (value > type_arrays_slots(db, value - 1)) {
+		// inside a batch grow by an eighth, so n new types cost O(n) copies
+		u32 slots = value;
+		if (ksu_sepol_batch_active)
+			slots += max_t(u32, value / 8, 16);
+		if (!grow_type_arrays(db, value - 1, slots))
+			return false;
+	}
+
 	ebitmap_init(&db->type_attr_map_array[value - 1]);
 	ebitmap_set_bit(&db->type_attr_map_array[value - 1], value - 1, 1);
 
-	db->type_val_to_struct_array = new_type_val_to_struct;
-	db->type_val_to_struct_array[value - 1] = type;
+	ksu_type_val_to_struct(db)[value - 1] = type;
 
-	db->sym_val_to_name[SYM_TYPES] = new_val_to_name_types;
 	db->sym_val_to_name[SYM_TYPES][value - 1] = key;
 
 	int i;
@@ -998,17 +1234,22 @@ static bool set_type_state(struct policydb *db, const char *type_name,
 		ksu_hashtab_for_each(db->p_types.table, node)
 		{
 			type = (struct type_datum *)(node->datum);
+			if (ebitmap_get_bit(&db->permissive_map, type->value) == permissive)
+				continue;
+			ksu_policy_changes++;
 			if (ebitmap_set_bit(&db->permissive_map, type->value,
 					    permissive))
 				pr_info("Could not set bit in permissive map\n");
 		};
 	} else {
-		type = (struct type_datum *)symtab_search(&db->p_types,
-							  type_name);
+		type = (struct type_datum *)sepol_search(&db->p_types, type_name);
 		if (type == NULL) {
 			pr_info("type %s does not exist\n", type_name);
 			return false;
 		}
+		if (ebitmap_get_bit(&db->permissive_map, type->value) == permissive)
+			return true;
+		ksu_policy_changes++;
 		if (ebitmap_set_bit(&db->permissive_map, type->value,
 				    permissive)) {
 			pr_info("Could not set bit in permissive map\n");
@@ -1033,6 +1274,11 @@ static void add_typeattribute_raw(struct policydb *db, struct type_datum *type,
 	struct ebitmap *sattr =
 		flex_array_get(db->type_attr_map_array, type->value - 1);
 #endif
+	// already a member, constraints were expanded back then
+	if (ebitmap_get_bit(sattr, attr->value - 1))
+		return;
+
+	ksu_policy_changes++;
 	ebitmap_set_bit(sattr, attr->value - 1, 1);
 
 	struct hashtab_node *node;
@@ -1057,7 +1303,7 @@ static void add_typeattribute_raw(struct policydb *db, struct type_datum *type,
 static bool add_typeattribute(struct policydb *db, const char *type,
 			      const char *attr)
 {
-	struct type_datum *type_d = symtab_search(&db->p_types, type);
+	struct type_datum *type_d = sepol_search(&db->p_types, type);
 	if (type_d == NULL) {
 		pr_info("type %s does not exist\n", type);
 		return false;
@@ -1066,7 +1312,7 @@ static bool add_typeattribute(struct policydb *db, const char *type,
 		return false;
 	}
 
-	struct type_datum *attr_d = symtab_search(&db->p_types, attr);
+	struct type_datum *attr_d = sepol_search(&db->p_types, attr);
 	if (attr_d == NULL) {
 		pr_info("attribute %s does not exist\n", type);
 		return false;
@@ -1082,6 +1328,60 @@ static bool add_typeattribute(struct policydb *db, const char *type,
 //////////////////////////////////////////////////////////////////////////
 
 // Operation on types
+bool ksu_reserve_types(struct policydb *db, u32 count)
+{
+#ifdef KSU_TYPE_ARRAYS_KVREALLOC
+	u32 used = db->p_types.nprim;
+
+	// type values end up in u16 avtab keys, never reserve past that
+	count = min_t(u32, count, used < U16_MAX ? U16_MAX - used : 0);
+	if (!ksu_sepol_batch_active || !count || used + count <= type_arrays_slots(db, used))
+		return true;
+	if (take_type_spare(db, used, used + count))
+		return true;
+	return grow_type_arrays(db, used, used + count);
+#else
+	return true;
+#endif
+}
+
+bool ksu_prepare_types(struct policydb *db, u32 count)
+{
+#ifdef KSU_TYPE_ARRAYS_KVREALLOC
+	struct sepol_type_spare *spare = &ksu_type_spare;
+	u32 used = db->p_types.nprim;
+	u32 slots;
+
+	ksu_release_types();
+
+	count = min_t(u32, count, used < U16_MAX ? U16_MAX - used : 0);
+	if (!count)
+		return true;
+
+	// nprim is read without the policy locked, ksu_reserve_types checks the size again
+	slots = used + count;
+	spare->attr_map = kvmalloc(slots * sizeof(struct ebitmap), GFP_KERNEL);
+	spare->val_to_struct = kvmalloc(slots * sizeof(struct type_datum *), GFP_KERNEL);
+	spare->val_to_name = kvmalloc(slots * sizeof(char *), GFP_KERNEL);
+	if (!spare->attr_map || !spare->val_to_struct || !spare->val_to_name) {
+		ksu_release_types();
+		return false;
+	}
+	spare->slots = slots;
+#endif
+	return true;
+}
+
+void ksu_release_types(void)
+{
+#ifdef KSU_TYPE_ARRAYS_KVREALLOC
+	kvfree(ksu_type_spare.attr_map);
+	kvfree(ksu_type_spare.val_to_struct);
+	kvfree(ksu_type_spare.val_to_name);
+	memset(&ksu_type_spare, 0, sizeof(ksu_type_spare));
+#endif
+}
+
 bool ksu_type(struct policydb *db, const char *name, const char *attr)
 {
 	return add_type(db, name, false) && add_typeattribute(db, name, attr);
@@ -1136,6 +1436,30 @@ bool ksu_dontaudit(struct policydb *db, const char *src, const char *tgt,
 	return add_rule(db, src, tgt, cls, perm, AVTAB_AUDITDENY, true);
 }
 
+bool ksu_allow_set(struct policydb *db, const struct ksu_sepol_set *src, const struct ksu_sepol_set *tgt,
+		   const struct ksu_sepol_set *cls, const struct ksu_sepol_set *perm)
+{
+	return add_rule_set(db, src, tgt, cls, perm, AVTAB_ALLOWED, false);
+}
+
+bool ksu_deny_set(struct policydb *db, const struct ksu_sepol_set *src, const struct ksu_sepol_set *tgt,
+		  const struct ksu_sepol_set *cls, const struct ksu_sepol_set *perm)
+{
+	return add_rule_set(db, src, tgt, cls, perm, AVTAB_ALLOWED, true);
+}
+
+bool ksu_auditallow_set(struct policydb *db, const struct ksu_sepol_set *src, const struct ksu_sepol_set *tgt,
+			const struct ksu_sepol_set *cls, const struct ksu_sepol_set *perm)
+{
+	return add_rule_set(db, src, tgt, cls, perm, AVTAB_AUDITALLOW, false);
+}
+
+bool ksu_dontaudit_set(struct policydb *db, const struct ksu_sepol_set *src, const struct ksu_sepol_set *tgt,
+		       const struct ksu_sepol_set *cls, const struct ksu_sepol_set *perm)
+{
+	return add_rule_set(db, src, tgt, cls, perm, AVTAB_AUDITDENY, true);
+}
+
 // Extended permissions access vector rules
 bool ksu_allowxperm(struct policydb *db, const char *src, const char *tgt,
 		    const char *cls, const char *range)
@@ -1202,6 +1526,54 @@ void ksu_destroy_sepolicy(struct selinux_policy *pol)
 	kfree(pol);
 }
 
+/*
+ * policydb.len is the size of the image the policy was loaded from
+ * get_avtab_node keeps it in step for avtab rules, but new types, attributes,
+ * type transitions and genfscon entries are not accounted, so the serialized
+ * form can outgrow it. write with headroom, and only retry bigger when
+ * policydb_write failed at the very end of the buffer, which is what running
+ * out of room looks like. an -EINVAL with room to spare is a real error
+ */
+#define KSU_POLICY_WRITE_RETRIES 2
+#define KSU_POLICY_WRITE_SLACK PAGE_SIZE
+
+static void *ksu_write_sepolicy(struct policydb *db, size_t *len)
+{
+	size_t size = db->len + db->len / 8;
+	int i;
+
+	for (i = 0; i <= KSU_POLICY_WRITE_RETRIES; i++) {
+		struct policy_file fp;
+		void *data = vmalloc(size);
+		int ret;
+
+		if (!data) {
+			pr_err("alloc policy len %zu\n", size);
+			return ERR_PTR(-ENOMEM);
+		}
+
+		fp.data = data;
+		fp.len = size;
+
+		ret = policydb_write(db, &fp);
+		if (!ret) {
+			*len = size - fp.len;
+			return data;
+		}
+
+		vfree(data);
+		if (ret != -EINVAL || fp.len >= KSU_POLICY_WRITE_SLACK) {
+			pr_err("sepolicy: policydb_write: %d, %zu of %zu bytes left\n", ret, fp.len, size);
+			return ERR_PTR(ret);
+		}
+
+		pr_info("sepolicy: policydb_write ran out of room at %zu bytes, retrying\n", size);
+		size *= 2;
+	}
+
+	return ERR_PTR(-ENOSPC);
+}
+
 struct selinux_policy *ksu_dup_sepolicy(struct selinux_policy *old_pol)
 {
 	int ret;
@@ -1209,23 +1581,11 @@ struct selinux_policy *ksu_dup_sepolicy(struct selinux_policy *old_pol)
 	struct selinux_policy *new_pol;
 	void *data;
 	struct policy_file fp;
+	u64 start = ktime_get_ns();
 
-	len = old_pol->policydb.len;
-	data = vmalloc(len);
-	if (!data) {
-		pr_err("alloc policy len %ld\n", len);
-		ret = -ENOMEM;
-		goto out_free_data;
-	}
-
-	fp.data = data;
-	fp.len = len;
-
-	ret = policydb_write(&old_pol->policydb, &fp);
-	if (ret) {
-		pr_err("sepolicy: policydb_write: %d\n", ret);
-		goto out_free_data;
-	}
+	data = ksu_write_sepolicy(&old_pol->policydb, &len);
+	if (IS_ERR(data))
+		return ERR_CAST(data);
 
 	// https://android-review.googlesource.com/c/kernel/common/+/3009995/11/security/selinux/ss/policydb.c
 	// fixup config
@@ -1253,7 +1613,6 @@ struct selinux_policy *ksu_dup_sepolicy(struct selinux_policy *old_pol)
 	}
 	memset(&new_pol->policydb, 0, sizeof(new_pol->policydb));
 
-	// rewind fp
 	fp.data = data;
 	fp.len = len;
 
@@ -1262,16 +1621,18 @@ struct selinux_policy *ksu_dup_sepolicy(struct selinux_policy *old_pol)
 		pr_err("sepolicy: policydb_read: %d\n", ret);
 		goto out_free_policydb;
 	}
-	new_pol->policydb.len = old_pol->policydb.len;
-	kvfree(data);
+	// never report less than the loaded image, /sys/fs/selinux/policy sizes its buffer from this
+	new_pol->policydb.len = max(len, old_pol->policydb.len);
+	vfree(data);
 
+	pr_info("sepolicy: dup %zu bytes in %llu us\n", len, (ktime_get_ns() - start) / NSEC_PER_USEC);
 	return new_pol;
 
 out_free_policydb:
 	kfree(new_pol);
 
 out_free_data:
-	kvfree(data);
+	vfree(data);
 
 	return ERR_PTR(ret);
 }
@@ -9,7 +9,41 @@ struct selinux_policy *ksu_dup_sepolicy(struct selinux_policy *old_pol);
 void ksu_destroy_sepolicy(struct selinux_policy *orig);
 #endif
 
+// policy change counter, equal before and after a command means it was a no-op
+unsigned long ksu_sepolicy_changes(void);
+
+/*
+ * one batch of commands, policy write side held from begin to end
+ * lookups of an interned batch are memoized by name pointer, and spare room
+ * in the type arrays is reused until end
+ */
+void ksu_sepolicy_batch_begin(bool interned);
+void ksu_sepolicy_batch_end(void);
+
+/*
+ * a set of names viewed straight from a v2 batch: count u16 indices into the
+ * batch string table, count == 0 means ALL
+ */
+struct ksu_sepol_set {
+	const char *const *table;
+	const u8 *indices;
+	u32 count;
+};
+
+static inline const char *ksu_sepol_set_name(const struct ksu_sepol_set *set, u32 i)
+{
+	u16 index;
+
+	memcpy(&index, set->indices + i * sizeof(index), sizeof(index));
+	return set->table[index];
+}
+
 // Operation on types
+// grow the type arrays once for count upcoming types, only kept inside a batch
+bool ksu_reserve_types(struct policydb *db, u32 count);
+// allocate that room ahead when the batch is applied atomic, release frees what is left after
+bool ksu_prepare_types(struct policydb *db, u32 count);
+void ksu_release_types(void);
 bool ksu_type(struct policydb *db, const char *name, const char *attr);
 bool ksu_attribute(struct policydb *db, const char *name);
 bool ksu_permissive(struct policydb *db, const char *type);
@@ -27,6 +61,16 @@ bool ksu_auditallow(struct policydb *db, const char *src, const char *tgt,
 bool ksu_dontaudit(struct policydb *db, const char *src, const char *tgt,
 		   const char *cls, const char *perm);
 
+// Access vector rules over sets, every (src, tgt, cls) node is touched once
+bool ksu_allow_set(struct policydb *db, const struct ksu_sepol_set *src, const struct ksu_sepol_set *tgt,
+		   const struct ksu_sepol_set *cls, const struct ksu_sepol_set *perm);
+bool ksu_deny_set(struct policydb *db, const struct ksu_sepol_set *src, const struct ksu_sepol_set *tgt,
+		  const struct ksu_sepol_set *cls, const struct ksu_sepol_set *perm);
+bool ksu_auditallow_set(struct policydb *db, const struct ksu_sepol_set *src, const struct ksu_sepol_set *tgt,
+			const struct ksu_sepol_set *cls, const struct ksu_sepol_set *perm);
+bool ksu_dontaudit_set(struct policydb *db, const struct ksu_sepol_set *src, const struct ksu_sepol_set *tgt,
+		       const struct ksu_sepol_set *cls, const struct ksu_sepol_set *perm);
+
 // Extended permissions access vector rules
 bool ksu_allowxperm(struct policydb *db, const char *src, const char *tgt,
 		    const char *cls, const char *range);
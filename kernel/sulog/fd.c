@@ -13,6 +13,8 @@ static unsigned __bitwise ksu_sulog_poll(struct file *file, poll_table *wait)
 
 static int ksu_sulog_release(struct inode *inode, struct file *file)
 {
+	ksu_fd_untrack(file);
+
 	mutex_lock(&ksu_sulog_fd_lock);
 	ksu_sulog_fd_active = false;
 	mutex_unlock(&ksu_sulog_fd_lock);
@@ -31,6 +33,7 @@ static const struct file_operations ksu_sulog_fops = {
 
 int ksu_install_sulog_fd(void)
 {
+	struct ksu_tracked_fd *t;
 	struct file *filp;
 	int fd;
 
@@ -50,14 +53,23 @@ int ksu_install_sulog_fd(void)
 	if (fd < 0)
 		goto out_unlock;
 
+	t = ksu_fd_track_prepare();
+	if (!t) {
+		put_unused_fd(fd);
+		fd = -ENOMEM;
+		goto out_unlock;
+	}
+
 	filp = anon_inode_getfile("[ksu_sulog]", &ksu_sulog_fops, NULL, O_RDONLY | O_CLOEXEC);
 	if (IS_ERR(filp)) {
+		ksu_fd_track_abort(t);
 		put_unused_fd(fd);
 		fd = PTR_ERR(filp);
 		goto out_unlock;
 	}
 
 	ksu_sulog_fd_active = true;
+	ksu_fd_track_commit(t, filp, KSU_FD_KIND_SULOG);
 	fd_install(fd, filp);
 	pr_info("sulog: fd installed %d for pid %d\n", fd, current->pid);
 
@@ -111,7 +111,33 @@ static int do_set_sepolicy(void __user *arg)
 		return -EFAULT;
 	}
 
-	return handle_sepolicy((void __user *)cmd.data, cmd.data_len);
+	return handle_sepolicy((void __user *)cmd.data, cmd.data_len, NULL, 0);
+}
+
+static int do_set_sepolicy_ex(void __user *arg)
+{
+	struct ksu_set_sepolicy_ex_cmd cmd;
+
+	if (copy_from_user(&cmd, arg, sizeof(cmd))) {
+		return -EFAULT;
+	}
+
+	if (cmd.reserved) {
+		return -EINVAL;
+	}
+
+	return handle_sepolicy((void __user *)cmd.data, cmd.data_len, (u8 __user *)cmd.results, cmd.results_len);
+}
+
+static int do_sepolicy_txn(void __user *arg)
+{
+	struct ksu_sepolicy_txn_cmd cmd;
+
+	if (copy_from_user(&cmd, arg, sizeof(cmd))) {
+		return -EFAULT;
+	}
+
+	return handle_sepolicy_txn(cmd.op);
 }
 
 static int do_check_safemode(void __user *arg)
@@ -485,96 +511,143 @@ static int do_nuke_ext4_sysfs(void __user *arg)
 
 struct list_head mount_list = LIST_HEAD_INIT(mount_list);
 DECLARE_RWSEM(mount_list_lock);
+unsigned long mount_list_gen = 0;
+
+// same entries as mount_list, for the dedupe on add and lookup on del
+#define MOUNT_HASH_BITS 8
+static DEFINE_HASHTABLE(mount_hash, MOUNT_HASH_BITS);
+
+#define KSU_UMOUNT_PATH_MAX 256
+
+// path has to be a kernel string shorter than KSU_UMOUNT_PATH_MAX
+static struct mount_entry *mount_entry_alloc(const char *path, unsigned int flags)
+{
+	size_t len = strlen(path);
+	struct mount_entry *entry = kmalloc(struct_size(entry, umountable, len + 1), GFP_KERNEL);
+
+	if (!entry)
+		return NULL;
+
+	memcpy(entry->umountable, path, len + 1);
+	entry->hash = jhash(path, len, 0);
+	entry->flags = flags;
+	return entry;
+}
+
+// caller holds mount_list_lock
+static struct mount_entry *mount_list_find(const char *path, u32 hash)
+{
+	struct mount_entry *entry;
+
+	hash_for_each_possible (mount_hash, entry, node, hash) {
+		if (entry->hash == hash && !strcmp(entry->umountable, path))
+			return entry;
+	}
+	return NULL;
+}
+
+// caller holds mount_list_lock for write, takes over entry unless -EEXIST
+static int mount_list_insert(struct mount_entry *entry)
+{
+	if (mount_list_find(entry->umountable, entry->hash))
+		return -EEXIST;
+
+	// newest first, so nested mounts go before their parents
+	list_add(&entry->list, &mount_list);
+	hash_add(mount_hash, &entry->node, entry->hash);
+	return 0;
+}
+
+// caller holds mount_list_lock for write
+static int mount_list_remove(const char *path, u32 hash)
+{
+	struct mount_entry *entry = mount_list_find(path, hash);
+
+	if (!entry)
+		return -ENOENT;
+
+	list_del(&entry->list);
+	hash_del(&entry->node);
+	kfree(entry);
+	return 0;
+}
+
+static int copy_umount_path(char *buf, u64 uptr)
+{
+	long len = strncpy_from_user(buf, (const char __user *)uptr, KSU_UMOUNT_PATH_MAX);
+
+	if (len <= 0)
+		return -EFAULT;
+	if (len == KSU_UMOUNT_PATH_MAX)
+		return -ENAMETOOLONG;
+	return 0;
+}
 
 static int add_try_umount(void __user *arg)
 {
 	struct mount_entry *new_entry, *entry, *tmp;
 	struct ksu_add_try_umount_cmd cmd;
-	char buf[256] = {0};
+	char buf[KSU_UMOUNT_PATH_MAX] = {0};
+	int ret;
 
 	if (copy_from_user(&cmd, arg, sizeof cmd))
 		return -EFAULT;
 
 	switch (cmd.mode) {
 		case KSU_UMOUNT_WIPE: {
-			struct mount_entry *entry, *tmp;
 			down_write(&mount_list_lock);
 			list_for_each_entry_safe(entry, tmp, &mount_list, list) {
 				pr_info("wipe_umount_list: removing entry: %s\n", entry->umountable);
 				list_del(&entry->list);
-				kfree(entry->umountable);
+				hash_del(&entry->node);
 				kfree(entry);
 			}
+			WRITE_ONCE(mount_list_gen, mount_list_gen + 1);
 			up_write(&mount_list_lock);
 
 			return 0;
 		}
 
 		case KSU_UMOUNT_ADD: {
-			long len = strncpy_from_user(buf, (const char __user *)cmd.arg, 256);
-			if (len <= 0)
-				return -EFAULT;	
-			
-			buf[sizeof(buf) - 1] = '\0';
+			ret = copy_umount_path(buf, cmd.arg);
+			if (ret)
+				return ret;
 
-			new_entry = kzalloc(sizeof(*new_entry), GFP_KERNEL);
+			new_entry = mount_entry_alloc(buf, cmd.flags);
 			if (!new_entry)
 				return -ENOMEM;
 
-			new_entry->umountable = kstrdup(buf, GFP_KERNEL);
-			if (!new_entry->umountable) {
-				kfree(new_entry);
-				return -ENOMEM;
-			}
-
 			down_write(&mount_list_lock);
+			ret = mount_list_insert(new_entry);
+			if (!ret)
+				WRITE_ONCE(mount_list_gen, mount_list_gen + 1);
+			up_write(&mount_list_lock);
 
-			// disallow dupes
-			// if this gets too many, we can consider moving this whole task to a kthread
-			list_for_each_entry(entry, &mount_list, list) {
-				if (!strcmp(entry->umountable, buf)) {
-					pr_info("cmd_add_try_umount: %s is already here!\n", buf);
-					up_write(&mount_list_lock);
-					kfree(new_entry->umountable);
-					kfree(new_entry);
-					return -EEXIST;
-				}
+			if (ret) {
+				pr_info("cmd_add_try_umount: %s is already here!\n", buf);
+				kfree(new_entry);
+				return ret;
 			}
 
-			// now check flags and add
-			// this also serves as a null check
-			if (cmd.flags)
-				new_entry->flags = cmd.flags;
-			else
-				new_entry->flags = 0;
-
-			// debug
-			list_add(&new_entry->list, &mount_list);
-			up_write(&mount_list_lock);
 			pr_info("cmd_add_try_umount: %s added!\n", buf);
-
 			return 0;
 		}
 
-		// this is just strcmp'd wipe anyway
 		case KSU_UMOUNT_DEL: {
-			long len = strncpy_from_user(buf, (const char __user *)cmd.arg, sizeof(buf) - 1);
-			if (len <= 0)
-				return -EFAULT;
-			
-			buf[sizeof(buf) - 1] = '\0';
+			ret = copy_umount_path(buf, cmd.arg);
+			if (ret)
+				return ret;
 
 			down_write(&mount_list_lock);
-			list_for_each_entry_safe(entry, tmp, &mount_list, list) {
-				if (!strcmp(entry->umountable, buf)) {
-					pr_info("cmd_add_try_umount: entry removed: %s\n", entry->umountable);
-					list_del(&entry->list);
-					kfree(entry->umountable);
-					kfree(entry);
-				}
-			}
+			ret = mount_list_remove(buf, jhash(buf, strlen(buf), 0));
+			if (!ret)
+				WRITE_ONCE(mount_list_gen, mount_list_gen + 1);
 			up_write(&mount_list_lock);
-			
+
+			if (!ret)
+				pr_info("cmd_add_try_umount: entry removed: %s\n", buf);
+
+			// deleting something that isn't there was never an error
 			return 0;
 		}
 
@@ -637,6 +710,227 @@ static int add_try_umount(void __user *arg)
 	return 0;
 }
 
+
+// one lock round and one generation bump for the whole array
+static int do_try_umount_batch(void __user *arg)
+{
+	struct ksu_try_umount_batch_cmd cmd;
+	struct ksu_try_umount_entry *ents;
+	struct mount_entry **pending;
+	char buf[KSU_UMOUNT_PATH_MAX];
+	u32 i, done = 0;
+	int ret = 0;
+
+	if (copy_from_user(&cmd, arg, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.reserved || (cmd.mode != KSU_UMOUNT_ADD && cmd.mode != KSU_UMOUNT_DEL))
+		return -EINVAL;
+
+	if (!cmd.count || cmd.count > KSU_TRY_UMOUNT_BATCH_MAX)
+		return -EINVAL;
+
+	ents = kvmalloc(cmd.count * sizeof(*ents), GFP_KERNEL);
+	if (!ents)
+		return -ENOMEM;
+
+	pending = kvmalloc(cmd.count * sizeof(*pending), GFP_KERNEL);
+	if (!pending) {
+		kvfree(ents);
+		return -ENOMEM;
+	}
+	memset(pending, 0, cmd.count * sizeof(*pending));
+
+	if (copy_from_user(ents, (const void __user *)cmd.entries, cmd.count * sizeof(*ents))) {
+		ret = -EFAULT;
+		goto out_free;
+	}
+
+	// everything that can fault or sleep for memory happens before the lock
+	for (i = 0; i < cmd.count; i++) {
+		ents[i].result = copy_umount_path(buf, ents[i].path);
+		if (ents[i].result)
+			continue;
+
+		pending[i] = mount_entry_alloc(buf, cmd.mode == KSU_UMOUNT_ADD ? ents[i].flags : 0);
+		if (!pending[i])
+			ents[i].result = -ENOMEM;
+	}
+
+	down_write(&mount_list_lock);
+	for (i = 0; i < cmd.count; i++) {
+		if (!pending[i])
+			continue;
+
+		if (cmd.mode == KSU_UMOUNT_ADD) {
+			ents[i].result = mount_list_insert(pending[i]);
+			if (!ents[i].result)
+				pending[i] = NULL; // owned by the list now
+		} else {
+			ents[i].result = mount_list_remove(pending[i]->umountable, pending[i]->hash);
+		}
+
+		if (!ents[i].result)
+			done++;
+	}
+	if (done)
+		WRITE_ONCE(mount_list_gen, mount_list_gen + 1);
+	up_write(&mount_list_lock);
+
+	pr_info("try_umount_batch: %s %u of %u entries\n",
+		cmd.mode == KSU_UMOUNT_ADD ? "added" : "removed", done, cmd.count);
+
+	cmd.done = done;
+	if (copy_to_user((void __user *)cmd.entries, ents, cmd.count * sizeof(*ents)) ||
+	    copy_to_user(arg, &cmd, sizeof(cmd)))
+		ret = -EFAULT;
+
+out_free:
+	for (i = 0; i < cmd.count; i++)
+		kfree(pending[i]);
+	kvfree(pending);
+	kvfree(ents);
+	return ret;
+}
+
+/*
+ * whole list in one go: count headers, then the strings they point into.
+ * if buf_size is too small nothing is copied, total_size says what to allocate
+ */
+static int do_get_try_umount_list(void __user *arg)
+{
+	struct ksu_get_try_umount_list_cmd cmd;
+	struct ksu_try_umount_list_entry *hdr;
+	struct mount_entry *entry;
+	size_t total, off;
+	void *kbuf = NULL;
+	u32 count = 0;
+	int ret = 0;
+
+	if (copy_from_user(&cmd, arg, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.reserved)
+		return -EINVAL;
+
+	down_read(&mount_list_lock);
+	total = 0;
+	list_for_each_entry (entry, &mount_list, list) {
+		total += sizeof(*hdr) + strlen(entry->umountable) + 1;
+		count++;
+	}
+
+	if (total > U32_MAX) {
+		ret = -E2BIG;
+		goto out_unlock;
+	}
+
+	cmd.total_size = total;
+	cmd.count = 0;
+	if (!cmd.buf || cmd.buf_size < total || !count)
+		goto out_unlock;
+
+	kbuf = kvmalloc(total, GFP_KERNEL);
+	if (!kbuf) {
+		ret = -ENOMEM;
+		goto out_unlock;
+	}
+
+	hdr = kbuf;
+	off = count * sizeof(*hdr);
+	list_for_each_entry (entry, &mount_list, list) {
+		size_t len = strlen(entry->umountable) + 1;
+
+		hdr->offset = off;
+		hdr->flags = entry->flags;
+		memcpy(kbuf + off, entry->umountable, len);
+		off += len;
+		hdr++;
+	}
+	cmd.count = count;
+
+out_unlock:
+	up_read(&mount_list_lock);
+	if (ret)
+		return ret;
+
+	if (kbuf && copy_to_user((void __user *)cmd.buf, kbuf, total))
+		ret = -EFAULT;
+	else if (copy_to_user(arg, &cmd, sizeof(cmd)))
+		ret = -EFAULT;
+
+	if (kbuf)
+		kvfree(kbuf);
+	return ret;
+}
+
+/*
+ * who holds our fds, found by walking fd tables in kernel. entries beyond
+ * buf_count are counted in total but not copied, ask again with a bigger buf
+ */
+static int do_get_fd_holders(void __user *arg)
+{
+	struct ksu_get_fd_holders_cmd cmd;
+	struct ksu_fd_holder *kbuf = NULL;
+	u32 max;
+	int ret = 0;
+
+	if (copy_from_user(&cmd, arg, sizeof(cmd)))
+		return -EFAULT;
+
+	max = cmd.buf ? min_t(u32, cmd.buf_count, KSU_FD_HOLDERS_MAX) : 0;
+	if (max) {
+		// sized once up front, the walk only fills it
+		kbuf = kvmalloc(max * sizeof(*kbuf), GFP_KERNEL);
+		if (!kbuf)
+			return -ENOMEM;
+	}
+
+	cmd.count = ksu_fd_holders_collect(kbuf, max, &cmd.total, &cmd.live);
+
+	if (cmd.count && copy_to_user((void __user *)cmd.buf, kbuf, cmd.count * sizeof(*kbuf)))
+		ret = -EFAULT;
+	else if (copy_to_user(arg, &cmd, sizeof(cmd)))
+		ret = -EFAULT;
+
+	if (kbuf)
+		kvfree(kbuf);
+	return ret;
+}
+
+static int do_umount_stats(void __user *arg)
+{
+	struct ksu_umount_stats_cmd *cmd;
+	u32 op;
+	int ret = 0;
+
+	if (copy_from_user(&op, arg, sizeof(op)))
+		return -EFAULT;
+
+	if (op == KSU_UMOUNT_STATS_RESET) {
+		ksu_umount_stats_reset();
+		pr_info("umount_stats: reset\n");
+		return 0;
+	}
+
+	if (op != KSU_UMOUNT_STATS_GET)
+		return -EINVAL;
+
+	// ~5k, too big for the stack
+	cmd = kzalloc(sizeof(*cmd), GFP_KERNEL);
+	if (!cmd)
+		return -ENOMEM;
+
+	cmd->op = op;
+	ksu_umount_stats_read(cmd);
+
+	if (copy_to_user(arg, cmd, sizeof(*cmd)))
+		ret = -EFAULT;
+
+	kfree(cmd);
+	return ret;
+}
+
 static int do_set_init_pgrp(void __user *arg)
 {
 	int err;
@@ -690,7 +984,67 @@ static int do_disable_escape_to_root(void __user *arg)
 	return 0;
 }
 
+static int do_submit_apk_verdicts(void __user *arg)
+{
+	struct ksu_submit_apk_verdicts_cmd cmd;
+	struct ksu_apk_verdict v;
+	bool matched = false;
+	u32 i;
+
+	if (copy_from_user(&cmd, arg, sizeof(cmd))) {
+		pr_err("submit_apk_verdicts: copy_from_user failed\n");
+		return -EFAULT;
+	}
+
+	if (cmd.count > KSU_APK_VERDICTS_MAX) {
+		pr_err("submit_apk_verdicts: too many entries: %u\n", cmd.count);
+		return -E2BIG;
+	}
+
+	char *path __attribute__((__cleanup__(ksu_kfree_byref))) = kmalloc(PATH_MAX, GFP_KERNEL);
+	if (!path)
+		return -ENOMEM;
+
+	struct ksu_apk_verdict __user *entries = (struct ksu_apk_verdict __user *)cmd.entries;
+	cmd.accepted = 0;
+
+	for (i = 0; i < cmd.count; i++) {
+		if (copy_from_user(&v, &entries[i], sizeof(v)))
+			return -EFAULT;
+
+		long len = strncpy_from_user(path, (const char __user *)v.path, PATH_MAX);
+		if (len <= 0 || len >= PATH_MAX)
+			continue;
+
+		// same scope as search_manager
+		if (!strstarts(path, "/data/app/"))
+			continue;
+
+		v.cert_sha256[sizeof(v.cert_sha256) - 1] = '\0';
+
+		int ret = ksu_apk_submit_verdict(path, &v);
+		if (ret == 0)
+			cmd.accepted++;
+		else if (ret == 1)
+			matched = true;
+	}
+
+	pr_info("submit_apk_verdicts: %u/%u accepted, manager candidate: %d\n",
+		cmd.accepted, cmd.count, matched);
+
+	// the manager may have been missed before, let the tracker verify it now
+	if (matched && !ksu_is_manager_appid_valid())
+		ksu_throne_tracker_rescan();
+
+	if (copy_to_user(arg, &cmd, sizeof(cmd)))
+		return -EFAULT;
+
+	return 0;
+}
+
 // IOCTL handlers mapping table
+static int do_ioctl_batch(void __user *arg);
+
 static const struct ksu_ioctl_cmd_map ksu_ioctl_handlers[] = {
 	{ .cmd = KSU_IOCTL_GRANT_ROOT, .name = "GRANT_ROOT", .handler = do_grant_root, .perm_check = allowed_for_su },
 	{ .cmd = KSU_IOCTL_GET_INFO, .name = "GET_INFO", .handler = do_get_info, .perm_check = always_allow },
@@ -716,31 +1070,166 @@ static const struct ksu_ioctl_cmd_map ksu_ioctl_handlers[] = {
 	{ .cmd = KSU_IOCTL_SET_INIT_PGRP, .name = "SET_INIT_PGRP", .handler = do_set_init_pgrp, .perm_check = only_root },
 	{ .cmd = KSU_IOCTL_GET_SULOG_FD, .name = "GET_SULOG_FD", .handler = do_get_sulog_fd, .perm_check = only_root },
 	{ .cmd = KSU_IOCTL_DISABLE_ESCAPE_TO_ROOT, .name = "DISABLE_ESCAPE_TO_ROOT", .handler = do_disable_escape_to_root, .perm_check = only_root },
+	{ .cmd = KSU_IOCTL_SUBMIT_APK_VERDICTS, .name = "SUBMIT_APK_VERDICTS", .handler = do_submit_apk_verdicts, .perm_check = only_root },
+	{ .cmd = KSU_IOCTL_SEPOLICY_TXN, .name = "SEPOLICY_TXN", .handler = do_sepolicy_txn, .perm_check = only_root },
+	{ .cmd = KSU_IOCTL_SET_SEPOLICY_EX, .name = "SET_SEPOLICY_EX", .handler = do_set_sepolicy_ex, .perm_check = only_root },
+	{ .cmd = KSU_IOCTL_TRY_UMOUNT_BATCH, .name = "TRY_UMOUNT_BATCH", .handler = do_try_umount_batch, .perm_check = manager_or_root },
+	{ .cmd = KSU_IOCTL_GET_TRY_UMOUNT_LIST, .name = "GET_TRY_UMOUNT_LIST", .handler = do_get_try_umount_list, .perm_check = manager_or_root },
+	{ .cmd = KSU_IOCTL_UMOUNT_STATS, .name = "UMOUNT_STATS", .handler = do_umount_stats, .perm_check = manager_or_root },
+	{ .cmd = KSU_IOCTL_BATCH, .name = "BATCH", .handler = do_ioctl_batch, .perm_check = always_allow }, // checks every sub command
+	{ .cmd = KSU_IOCTL_GET_FD_HOLDERS, .name = "GET_FD_HOLDERS", .handler = do_get_fd_holders, .perm_check = only_root },
 	{ .cmd = 0, .name = NULL, .handler = NULL, .perm_check = NULL } // Sentinel
 };
 
-long ksu_supercall_handle_ioctl(unsigned int cmd, void __user *argp)
+/*
+ * direct lookup by ioctl number, built once at init.
+ * a few numbers are shared by legacy variants with another size or direction,
+ * those are chained in table order. entries are index + 1, 0 ends the chain
+ */
+static u8 ksu_ioctl_first[1 << _IOC_NRBITS];
+static u8 ksu_ioctl_next[ARRAY_SIZE(ksu_ioctl_handlers)];
+
+void __init ksu_supercall_build_index(void)
 {
 	int i;
 
+	BUILD_BUG_ON(ARRAY_SIZE(ksu_ioctl_handlers) > U8_MAX);
+
+	// backwards, skipping the sentinel, so chains keep the table order
+	for (i = ARRAY_SIZE(ksu_ioctl_handlers) - 2; i >= 0; i--) {
+		u32 nr = _IOC_NR(ksu_ioctl_handlers[i].cmd);
+
+		ksu_ioctl_next[i] = ksu_ioctl_first[nr];
+		ksu_ioctl_first[nr] = i + 1;
+	}
+}
+
+static const struct ksu_ioctl_cmd_map *ksu_ioctl_lookup(unsigned int cmd)
+{
+	u8 idx;
+
+	if (_IOC_TYPE(cmd) != 'K')
+		return NULL;
+
+	for (idx = ksu_ioctl_first[_IOC_NR(cmd)]; idx; idx = ksu_ioctl_next[idx - 1]) {
+		if (ksu_ioctl_handlers[idx - 1].cmd == cmd)
+			return &ksu_ioctl_handlers[idx - 1];
+	}
+	return NULL;
+}
+
+long ksu_supercall_handle_ioctl(unsigned int cmd, void __user *argp)
+{
+	const struct ksu_ioctl_cmd_map *h;
+
 #ifdef CONFIG_KSU_DEBUG
 	pr_info("ksu ioctl: cmd=0x%x from uid=%d\n", cmd, current_uid().val);
 #endif
 
-	for (i = 0; ksu_ioctl_handlers[i].handler; i++) {
-		if (cmd == ksu_ioctl_handlers[i].cmd) {
-			// Check permission first
-			if (ksu_ioctl_handlers[i].perm_check && !ksu_ioctl_handlers[i].perm_check()) {
-				pr_warn("ksu ioctl: permission denied for cmd=0x%x uid=%d\n", cmd, current_uid().val);
-				return -EPERM;
+	h = ksu_ioctl_lookup(cmd);
+	if (!h) {
+		pr_warn("ksu ioctl: unsupported command 0x%x\n", cmd);
+		return -ENOTTY;
+	}
+
+	// Check permission first
+	if (h->perm_check && !h->perm_check()) {
+		pr_warn("ksu ioctl: permission denied for cmd=0x%x uid=%d\n", cmd, current_uid().val);
+		return -EPERM;
+	}
+
+	// Execute handler
+	return h->handler(argp);
+}
+
+/*
+ * runs the sub commands in order, each permission check is evaluated at most
+ * once per batch since they only depend on the caller. a command that commits
+ * new creds (GRANT_ROOT) changes the caller, the remembered checks go with it
+ */
+#define KSU_BATCH_PERM_SLOTS 8
+
+static int do_ioctl_batch(void __user *arg)
+{
+	struct {
+		ksu_perm_check_t check;
+		bool allowed;
+	} perms[KSU_BATCH_PERM_SLOTS];
+	struct ksu_ioctl_batch_cmd cmd;
+	struct ksu_ioctl_batch_entry *ents;
+	const struct ksu_ioctl_cmd_map *h;
+	const struct cred *cred;
+	u32 i, j, nperms = 0;
+	int ret = 0;
+
+	if (copy_from_user(&cmd, arg, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.flags & ~KSU_IOCTL_BATCH_STOP_ON_ERROR)
+		return -EINVAL;
+
+	if (!cmd.count || cmd.count > KSU_IOCTL_BATCH_MAX)
+		return -EINVAL;
+
+	ents = kmalloc_array(cmd.count, sizeof(*ents), GFP_KERNEL);
+	if (!ents)
+		return -ENOMEM;
+
+	if (copy_from_user(ents, (const void __user *)cmd.entries, cmd.count * sizeof(*ents))) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	for (i = 0; i < cmd.count; i++)
+		ents[i].result = -ECANCELED;
+
+	for (i = 0; i < cmd.count; i++) {
+		bool allowed = true;
+
+		h = ksu_ioctl_lookup(ents[i].cmd);
+		// no nesting
+		if (!h || h->handler == do_ioctl_batch) {
+			ents[i].result = -ENOTTY;
+			goto next;
+		}
+
+		if (h->perm_check) {
+			for (j = 0; j < nperms && perms[j].check != h->perm_check; j++)
+				;
+			if (j == nperms) {
+				allowed = h->perm_check();
+				if (nperms < KSU_BATCH_PERM_SLOTS) {
+					perms[nperms].check = h->perm_check;
+					perms[nperms].allowed = allowed;
+					nperms++;
+				}
+			} else {
+				allowed = perms[j].allowed;
 			}
-			// Execute handler
-			return ksu_ioctl_handlers[i].handler(argp);
 		}
+
+		if (!allowed) {
+			pr_warn("ksu ioctl: permission denied for cmd=0x%x uid=%d\n", ents[i].cmd, current_uid().val);
+			ents[i].result = -EPERM;
+			goto next;
+		}
+
+		cred = current_cred();
+		ents[i].result = h->handler((void __user *)ents[i].arg);
+		// commit_creds always installs a new cred, so the pointer tells
+		if (current_cred() != cred)
+			nperms = 0;
+next:
+		if (ents[i].result < 0 && (cmd.flags & KSU_IOCTL_BATCH_STOP_ON_ERROR))
+			break;
 	}
 
-	pr_warn("ksu ioctl: unsupported command 0x%x\n", cmd);
-	return -ENOTTY;
+	if (copy_to_user((void __user *)cmd.entries, ents, cmd.count * sizeof(*ents)))
+		ret = -EFAULT;
+
+out:
+	kfree(ents);
+	return ret;
 }
 
 void __init ksu_supercall_dump_commands(void)
@@ -8,6 +8,7 @@ bool always_allow(void);
 bool allowed_for_su(void);
 
 long ksu_supercall_handle_ioctl(unsigned int cmd, void __user *argp);
+void ksu_supercall_build_index(void);
 void ksu_supercall_dump_commands(void);
 void ksu_supercall_cleanup_state(void);
 
@@ -1,5 +1,7 @@
 static int anon_ksu_release(struct inode *inode, struct file *filp)
 {
+	ksu_fd_untrack(filp);
+	ksu_sepolicy_txn_release();
 	pr_info("ksu fd released\n");
 	return 0;
 }
@@ -20,6 +22,7 @@ static const struct file_operations anon_ksu_fops = {
 // Install KSU fd to current process
 int ksu_install_fd(void)
 {
+	struct ksu_tracked_fd *t;
 	struct file *filp;
 	int fd;
 
@@ -30,15 +33,23 @@ int ksu_install_fd(void)
 		return fd;
 	}
 
+	t = ksu_fd_track_prepare();
+	if (!t) {
+		put_unused_fd(fd);
+		return -ENOMEM;
+	}
+
 	// Create anonymous inode file
 	filp = anon_inode_getfile("[ksu_driver]", &anon_ksu_fops, NULL, O_RDWR | O_CLOEXEC);
 	if (IS_ERR(filp)) {
 		pr_err("ksu_install_fd: failed to create anon inode file\n");
+		ksu_fd_track_abort(t);
 		put_unused_fd(fd);
 		return PTR_ERR(filp);
 	}
 
 	// Install fd
+	ksu_fd_track_commit(t, filp, KSU_FD_KIND_DRIVER);
 	fd_install(fd, filp);
 
 	pr_info("ksu fd installed: %d for pid %d\n", fd, current->pid);
@@ -59,6 +70,22 @@ static inline int ksu_handle_fd_request(void __user *arg4)
 	return 0;
 }
 
+static int ksu_match_driver_fd(const void *p, struct file *file, unsigned int fd)
+{
+	return file->f_op == &anon_ksu_fops ? fd + 1 : 0;
+}
+
+// lets userspace skip walking /proc/self/fd, iterate_fd stops at the first hit
+static inline int ksu_handle_fd_query(void __user *arg4)
+{
+	int fd = iterate_fd(current->files, 0, ksu_match_driver_fd, NULL) - 1;
+
+	if (copy_to_user(arg4, &fd, sizeof(fd)))
+		pr_err("query ksu fd reply err\n");
+
+	return 0;
+}
+
 // downstream: make sure to pass arg as reference, this can allow us to extend things.
 int ksu_handle_sys_reboot(int magic1, int magic2, unsigned int cmd, void __user **arg)
 {
@@ -81,6 +108,10 @@ int ksu_handle_sys_reboot(int magic1, int magic2, unsigned int cmd, void __user
 		return ksu_handle_fd_request(arg4);
 	}
 
+	if (magic2 == KSU_QUERY_FD_MAGIC2) {
+		return ksu_handle_fd_query(arg4);
+	}
+
 	// only root is allowed for these commands
 	if (current_uid().val != 0)
 		return 0;
@@ -204,9 +235,13 @@ int ksu_handle_sys_reboot(int magic1, int magic2, unsigned int cmd, void __user
 
 void __init ksu_supercalls_init(void)
 {
+	ksu_supercall_build_index();
 	ksu_supercall_dump_commands();
 	
 	tiny_sulog_init_heap(); // grab heap memory for sulog
 }
 
-void __exit ksu_supercalls_exit(void) { }
+void __exit ksu_supercalls_exit(void)
+{
+	ksu_mount_ns_exit(); // cached by GRANT_ROOT and su escalations
+}
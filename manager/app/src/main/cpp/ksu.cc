@@ -11,6 +11,8 @@
 #include <android/log.h>
 #include <dirent.h>
 #include <cstdlib>
+#include <algorithm>
+#include <vector>
 
 #include <unistd.h>
 #include <climits>
@@ -63,11 +65,22 @@ static inline int scan_driver_fd() {
     return found;
 }
 
+// kernels that know the query overwrite found with the driver fd or -1,
+// older ones leave it at INT_MIN
+static inline int query_driver_fd() {
+    int found = INT_MIN;
+    syscall(SYS_reboot, KSU_INSTALL_MAGIC1, KSU_QUERY_FD_MAGIC2, 0, &found);
+    return found;
+}
+
 template<typename... Args>
 static int ksuctl(unsigned long op, Args &&... args) {
 
     if (fd < 0) {
-        fd = scan_driver_fd();
+        fd = query_driver_fd();
+        if (fd == INT_MIN) {
+            fd = scan_driver_fd();
+        }
     }
 
     static_assert(sizeof...(Args) <= 1, "ioctl expects at most one extra argument");
@@ -75,6 +88,38 @@ static int ksuctl(unsigned long op, Args &&... args) {
     return ioctl(fd, op, std::forward<Args>(args)...);
 }
 
+// runs the entries through KSU_IOCTL_BATCH, at most KSU_IOCTL_BATCH_MAX per
+// ioctl, and falls back to one ioctl per entry on kernels that predate it.
+// every entry gets its own result, the return value is 0 or the -errno of a
+// batch ioctl that failed as a whole
+static int ksuctl_batch(struct ksu_ioctl_batch_entry *entries, size_t count) {
+    for (size_t done = 0; done < count;) {
+        size_t n = std::min<size_t>(count - done, KSU_IOCTL_BATCH_MAX);
+        struct ksu_ioctl_batch_cmd cmd = {};
+        cmd.entries = (uint64_t) (uintptr_t) (entries + done);
+        cmd.count = n;
+        if (ksuctl(KSU_IOCTL_BATCH, &cmd) < 0) {
+            if (errno != ENOTTY) {
+                return -errno;
+            }
+            // kernel predates BATCH
+            for (size_t i = done; i < done + n; i++) {
+                int ret = ksuctl(entries[i].cmd, (void *) (uintptr_t) entries[i].arg);
+                entries[i].result = ret < 0 ? -errno : ret;
+            }
+        }
+        done += n;
+    }
+    return 0;
+}
+
+static inline struct ksu_ioctl_batch_entry batch_entry(uint32_t cmd, void *arg) {
+    struct ksu_ioctl_batch_entry entry = {};
+    entry.cmd = cmd;
+    entry.arg = (uint64_t) (uintptr_t) arg;
+    return entry;
+}
+
 static struct ksu_get_info_cmd g_version {};
 
 struct ksu_get_info_cmd get_info() {
@@ -234,3 +279,63 @@ bool is_selinux_hide_enabled() {
     }
     return value != 0;
 }
+
+// same key and uid as Natives.NON_ROOT_DEFAULT_PROFILE_KEY / NOBODY_UID
+#define NON_ROOT_DEFAULT_PROFILE_KEY "$"
+#define NOBODY_UID 9999
+
+bool get_kernel_state(struct ksu_kernel_state *state) {
+    struct ksu_get_info_cmd info = {};
+    struct ksu_check_safemode_cmd safemode = {};
+    struct ksu_new_get_allow_list_cmd allow_list = {};
+    struct ksu_get_feature_cmd su = {.feature_id = KSU_FEATURE_SU_COMPAT};
+    struct ksu_get_feature_cmd umount = {.feature_id = KSU_FEATURE_KERNEL_UMOUNT};
+    struct ksu_get_feature_cmd selinux_hide = {.feature_id = KSU_FEATURE_SELINUX_HIDE};
+    struct ksu_get_app_profile_cmd non_root = {};
+    non_root.profile.version = KSU_APP_PROFILE_VER;
+    strcpy(non_root.profile.key, NON_ROOT_DEFAULT_PROFILE_KEY);
+    non_root.profile.curr_uid = NOBODY_UID;
+
+    struct ksu_ioctl_batch_entry entries[] = {
+        batch_entry(KSU_IOCTL_GET_INFO, &info),
+        batch_entry(KSU_IOCTL_CHECK_SAFEMODE, &safemode),
+        batch_entry(KSU_IOCTL_NEW_GET_ALLOW_LIST, &allow_list),
+        batch_entry(KSU_IOCTL_GET_FEATURE, &su),
+        batch_entry(KSU_IOCTL_GET_FEATURE, &umount),
+        batch_entry(KSU_IOCTL_GET_FEATURE, &selinux_hide),
+        batch_entry(KSU_IOCTL_GET_APP_PROFILE, &non_root),
+    };
+    if (ksuctl_batch(entries, sizeof(entries) / sizeof(entries[0])) < 0) {
+        return false;
+    }
+
+    if (entries[0].result == 0 && !g_version.version) {
+        g_version = info;
+    }
+
+    *state = {};
+    state->safe_mode = entries[1].result == 0 && safemode.in_safe_mode;
+    state->superuser_count = entries[2].result == 0 ? allow_list.total_count : 0;
+    state->su_enabled = entries[3].result == 0 && su.supported && su.value != 0;
+    state->kernel_umount_enabled = entries[4].result == 0 && umount.supported && umount.value != 0;
+    state->selinux_hide_enabled =
+            entries[5].result == 0 && selinux_hide.supported && selinux_hide.value != 0;
+    state->default_umount_modules = entries[6].result == 0 && !non_root.profile.allow_su &&
+            non_root.profile.nrp_config.profile.umount_modules;
+    return true;
+}
+
+void get_app_profiles(app_profile *profiles, int *results, size_t count) {
+    std::vector<struct ksu_get_app_profile_cmd> cmds(count);
+    std::vector<struct ksu_ioctl_batch_entry> entries(count);
+    for (size_t i = 0; i < count; i++) {
+        cmds[i].profile = profiles[i];
+        entries[i] = batch_entry(KSU_IOCTL_GET_APP_PROFILE, &cmds[i]);
+    }
+
+    int ret = ksuctl_batch(entries.data(), count);
+    for (size_t i = 0; i < count; i++) {
+        results[i] = ret < 0 ? ret : entries[i].result;
+        profiles[i] = cmds[i].profile;
+    }
+}
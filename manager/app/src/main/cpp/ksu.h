@@ -53,6 +53,21 @@ bool is_selinux_hide_enabled();
 
 bool get_allow_list(struct ksu_new_get_allow_list_cmd *);
 
+// Everything the manager reads on startup, fetched with one KSU_IOCTL_BATCH
+struct ksu_kernel_state {
+    bool safe_mode;
+    bool su_enabled;
+    bool kernel_umount_enabled;
+    bool selinux_hide_enabled;
+    bool default_umount_modules;
+    uint32_t superuser_count;
+};
+
+bool get_kernel_state(struct ksu_kernel_state *state);
+
+// Batched get_app_profile, results[i] is 0 or -errno for profiles[i]
+void get_app_profiles(app_profile *profiles, int *results, size_t count);
+
 inline std::pair<int, int> legacy_get_info() {
     int32_t version = -1;
     int32_t flags = 0;
@@ -62,6 +62,17 @@ object Natives {
     external fun getAppProfile(key: String?, uid: Int): Profile
     external fun setAppProfile(profile: Profile?): Boolean
 
+    /**
+     * Get the profiles of several packages with one batched ioctl.
+     * @return return null if failed.
+     */
+    external fun getAppProfiles(keys: Array<String>, uids: IntArray): Array<Profile>?
+
+    /**
+     * Safe mode, feature switches and superuser count, read with one batched ioctl.
+     */
+    external fun getKernelState(): KernelState
+
     /**
      * `su` compat mode can be disabled temporarily.
      *  0: disabled
@@ -130,6 +141,17 @@ object Natives {
         return (version != -1 && version < MINIMAL_SUPPORTED_KERNEL) || checkUAPIMismatch()
     }
 
+    @Keep
+    @Immutable
+    data class KernelState(
+        val isSafeMode: Boolean,
+        val isSuEnabled: Boolean,
+        val isKernelUmountEnabled: Boolean,
+        val isSelinuxHideEnabled: Boolean,
+        val isDefaultUmountModules: Boolean,
+        val superuserCount: Int,
+    )
+
     @Keep
     @Immutable
     @Parcelize
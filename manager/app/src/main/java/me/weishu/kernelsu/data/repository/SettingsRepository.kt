@@ -53,5 +53,7 @@ interface SettingsRepository {
 
     fun isLkmMode(): Boolean
 
+    fun getKernelState(): Natives.KernelState
+
     fun execKsudFeatureSave()
 }
@@ -188,6 +188,8 @@ class SettingsRepositoryImpl : SettingsRepository {
 
     override fun isLkmMode(): Boolean = Natives.isLkmMode
 
+    override fun getKernelState(): Natives.KernelState = Natives.getKernelState()
+
     override fun execKsudFeatureSave() {
         execKsud("feature save", true)
     }
@@ -66,17 +66,16 @@ class SuperUserRepositoryImpl : SuperUserRepository {
                     iface.getPackages(0)
                 }
 
-                val packages = slice.list
-                val newApps = packages.filter {
+                val packages = slice.list.filter {
                     val ai = it.applicationInfo ?: return@filter false
                     (ai.flags and ApplicationInfo.FLAG_HAS_CODE) != 0
-                }.map {
-                    val appInfo = it.applicationInfo!!
-                    val profile = Natives.getAppProfile(it.packageName, appInfo.uid)
+                }
+                val profiles = getAppProfiles(packages.map { it.packageName to it.applicationInfo!!.uid })
+                val newApps = packages.mapIndexed { i, pkg ->
                     AppInfo(
-                        label = appInfo.loadLabel(pm).toString(),
-                        packageInfo = it,
-                        profile = profile,
+                        label = pkg.applicationInfo!!.loadLabel(pm).toString(),
+                        packageInfo = pkg,
+                        profile = profiles[i],
                     )
                 }
 
@@ -94,13 +93,19 @@ class SuperUserRepositoryImpl : SuperUserRepository {
         runCatching {
             if (currentApps.isEmpty()) return@runCatching emptyList()
 
-            currentApps.map {
-                val profile = Natives.getAppProfile(it.packageName, it.uid)
-                it.copy(profile = profile)
-            }
+            val profiles = getAppProfiles(currentApps.map { it.packageName to it.uid })
+            currentApps.mapIndexed { i, app -> app.copy(profile = profiles[i]) }
         }
     }
 
+    // one batched ioctl for the whole list, per package lookups if that fails
+    private fun getAppProfiles(apps: List<Pair<String, Int>>): List<Natives.Profile> {
+        val keys = apps.map { it.first }.toTypedArray()
+        val uids = apps.map { it.second }.toIntArray()
+        return Natives.getAppProfiles(keys, uids)?.toList()
+            ?: apps.map { Natives.getAppProfile(it.first, it.second) }
+    }
+
     private suspend inline fun connectKsuService(
         crossinline onDisconnect: () -> Unit = {}
     ): Pair<IBinder, ServiceConnection> = withContext(Dispatchers.Main) {
@@ -3,7 +3,12 @@ package me.weishu.kernelsu.ui.util
 import android.os.SystemClock
 import com.topjohnwu.superuser.io.SuFile
 import com.topjohnwu.superuser.io.SuFileInputStream
+import java.io.ByteArrayInputStream
+import java.io.ByteArrayOutputStream
+import java.io.InputStream
 import java.io.InputStreamReader
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
 import java.time.Instant
 import java.time.LocalDate
 import java.time.ZoneId
@@ -15,7 +20,8 @@ private const val SULOG_DIR = "/data/adb/ksu/log"
 private const val SULOG_LINE_LIMIT = 1000
 private const val SULOG_FILE_PREFIX = "sulog-"
 private const val SULOG_FILE_SUFFIX = ".log"
-private val SULOG_FILE_NAME_REGEX = Regex("""$SULOG_FILE_PREFIX(\d{4}-\d{2}-\d{2})(?:-(\d+))?$SULOG_FILE_SUFFIX""")
+private const val SULOG_COMPRESSED_SUFFIX = ".lz4"
+private val SULOG_FILE_NAME_REGEX = Regex("""$SULOG_FILE_PREFIX(\d{4}-\d{2}-\d{2})(?:-(\d+))?$SULOG_FILE_SUFFIX(?:$SULOG_COMPRESSED_SUFFIX)?""")
 private const val NS_PER_MILLISECOND = 1_000_000L
 private val SULOG_TIMESTAMP_FORMATTER: DateTimeFormatter = DateTimeFormatter.ofPattern("yyyy-MM-dd HH:mm:ss", Locale.US)
 
@@ -109,7 +115,7 @@ fun readSulogFile(path: String): List<String> {
     }
 
     val lines = ArrayDeque<String>(SULOG_LINE_LIMIT)
-    SuFileInputStream.open(suFile).use { input ->
+    openSulogStream(suFile, path).use { input ->
         InputStreamReader(input).buffered().useLines { sequence ->
             sequence.forEach { line ->
                 if (lines.size == SULOG_LINE_LIMIT) {
@@ -122,6 +128,67 @@ fun readSulogFile(path: String): List<String> {
     return lines.toList()
 }
 
+private fun openSulogStream(suFile: SuFile, path: String): InputStream {
+    if (!path.endsWith(SULOG_COMPRESSED_SUFFIX)) {
+        return SuFileInputStream.open(suFile)
+    }
+    val compressed = SuFileInputStream.open(suFile).use { it.readBytes() }
+    return ByteArrayInputStream(decompressSulogSegment(compressed))
+}
+
+// Sealed segments are a sequence of [u32 raw_len][u32 compressed_len][lz4 block] records written by ksud.
+internal fun decompressSulogSegment(data: ByteArray): ByteArray {
+    val header = ByteBuffer.wrap(data).order(ByteOrder.LITTLE_ENDIAN)
+    val output = ByteArrayOutputStream(data.size * 4)
+    var offset = 0
+    while (offset + 8 <= data.size) {
+        val rawLength = header.getInt(offset)
+        val blockLength = header.getInt(offset + 4)
+        offset += 8
+        if (rawLength < 0 || blockLength < 0 || offset + blockLength > data.size) break
+        output.write(decompressLz4Block(data, offset, blockLength, rawLength))
+        offset += blockLength
+    }
+    return output.toByteArray()
+}
+
+private fun decompressLz4Block(src: ByteArray, start: Int, length: Int, rawLength: Int): ByteArray {
+    val dst = ByteArray(rawLength)
+    val end = start + length
+    var input = start
+    var output = 0
+    while (input < end) {
+        val token = src[input++].toInt() and 0xff
+        var literalLength = token ushr 4
+        if (literalLength == 15) {
+            do {
+                val extra = src[input++].toInt() and 0xff
+                literalLength += extra
+            } while (extra == 255)
+        }
+        System.arraycopy(src, input, dst, output, literalLength)
+        input += literalLength
+        output += literalLength
+        if (input >= end) break
+
+        val matchOffset = (src[input].toInt() and 0xff) or ((src[input + 1].toInt() and 0xff) shl 8)
+        input += 2
+        var matchLength = token and 0x0f
+        if (matchLength == 15) {
+            do {
+                val extra = src[input++].toInt() and 0xff
+                matchLength += extra
+            } while (extra == 255)
+        }
+        matchLength += 4
+        var matchStart = output - matchOffset
+        repeat(matchLength) {
+            dst[output++] = dst[matchStart++]
+        }
+    }
+    return if (output == rawLength) dst else dst.copyOf(output)
+}
+
 fun parseSulogLines(lines: List<String>): List<SulogEntry> {
     val currentTimeMillis = System.currentTimeMillis()
     val uptimeMillis = SystemClock.uptimeMillis()
@@ -318,8 +385,9 @@ internal fun parseSulogTimestampText(
 }
 
 internal fun String.toSulogDisplayName(): String {
-    return if (startsWith(SULOG_FILE_PREFIX) && endsWith(SULOG_FILE_SUFFIX)) {
-        removePrefix(SULOG_FILE_PREFIX).removeSuffix(SULOG_FILE_SUFFIX)
+    val name = removeSuffix(SULOG_COMPRESSED_SUFFIX)
+    return if (name.startsWith(SULOG_FILE_PREFIX) && name.endsWith(SULOG_FILE_SUFFIX)) {
+        name.removePrefix(SULOG_FILE_PREFIX).removeSuffix(SULOG_FILE_SUFFIX)
     } else {
         this
     }
@@ -48,21 +48,22 @@ class SettingsViewModel(
             val isLkmMode = repo.isLkmMode()
 
             // Async loading for natives/features
+            val kernelState = repo.getKernelState()
             val suCompatStatus = repo.getSuCompatStatus()
             val suCompatPersistValue = repo.getSuCompatPersistValue()
-            val isSuEnabled = repo.isSuEnabled()
+            val isSuEnabled = kernelState.isSuEnabled
 
             val suCompatMode = if (suCompatPersistValue == 0L) 2 else if (!isSuEnabled) 1 else 0
 
             val kernelUmountStatus = repo.getKernelUmountStatus()
-            val isKernelUmountEnabled = repo.isKernelUmountEnabled()
+            val isKernelUmountEnabled = kernelState.isKernelUmountEnabled
             val selinuxHideStatus = repo.getSelinuxHideStatus()
-            val isSelinuxHideEnabled = repo.isSelinuxHideEnabled()
+            val isSelinuxHideEnabled = kernelState.isSelinuxHideEnabled
             val sulogStatus = repo.getSulogStatus()
             val isSulogEnabled = repo.getSulogPersistValue() == 1L
             val adbRootStatus = repo.getAdbRootStatus()
             val isAdbRootEnabled = repo.getAdbRootPersistValue() == 1L
-            val isDefaultUmountModules = repo.isDefaultUmountModules()
+            val isDefaultUmountModules = kernelState.isDefaultUmountModules
             val uiMode = repo.uiMode
             val autoJailbreak = repo.autoJailbreak
             val isLateLoadMode = Natives.isLateLoadMode
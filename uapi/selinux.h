@@ -12,6 +12,8 @@ static const __u32 KSU_SEPOLICY_CMD_ATTR = 6;
 static const __u32 KSU_SEPOLICY_CMD_TYPE_TRANSITION = 7;
 static const __u32 KSU_SEPOLICY_CMD_TYPE_CHANGE = 8;
 static const __u32 KSU_SEPOLICY_CMD_GENFSCON = 9;
+/* NORMAL_PERM with a set per argument, v2 batches only */
+static const __u32 KSU_SEPOLICY_CMD_NORMAL_PERM_SET = 10;
 
 static const __u32 KSU_SEPOLICY_SUBCMD_NORMAL_PERM_ALLOW = 1;
 static const __u32 KSU_SEPOLICY_SUBCMD_NORMAL_PERM_DENY = 2;
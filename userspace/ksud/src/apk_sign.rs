@@ -2,13 +2,16 @@ use anyhow::{Result, ensure};
 use std::io::{Read, Seek, SeekFrom};
 
 pub fn get_apk_signature(apk: &str) -> Result<(u32, String)> {
+    let mut f = std::fs::File::open(apk)?;
+    read_apk_signature(&mut f)
+}
+
+fn read_apk_signature(f: &mut std::fs::File) -> Result<(u32, String)> {
     let mut buffer = [0u8; 0x10];
     let mut size4 = [0u8; 4];
     let mut size8 = [0u8; 8];
     let mut size_of_block = [0u8; 8];
 
-    let mut f = std::fs::File::open(apk)?;
-
     let mut i = 0;
     loop {
         let mut n = [0u8; 2];
@@ -66,7 +69,7 @@ pub fn get_apk_signature(apk: &str) -> Result<(u32, String)> {
 
         let id = u32::from_le_bytes(id);
         if id == 0x7109_871a_u32 {
-            v2_signing = Some(calc_cert_sha256(&mut f, &mut size4, &mut offset)?);
+            v2_signing = Some(calc_cert_sha256(f, &mut size4, &mut offset)?);
         } else if id == 0xf053_68c0_u32 {
             // v3 signature scheme
             v3_signing_exist = true;
@@ -113,3 +116,136 @@ fn calc_cert_sha256(
 
     Ok((cert_len, sha256::digest(&cert)))
 }
+
+/// Signature of one `base.apk`, together with the file identity it was read from.
+#[cfg(target_os = "android")]
+struct ApkVerdict {
+    path: std::ffi::CString,
+    ino: u64,
+    size: i64,
+    mtime_sec: i64,
+    mtime_nsec: u32,
+    cert_size: u32,
+    cert_sha256: String,
+}
+
+#[cfg(target_os = "android")]
+fn collect_base_apks(dir: &std::path::Path, depth: u32, out: &mut Vec<std::path::PathBuf>) {
+    let Ok(entries) = std::fs::read_dir(dir) else {
+        return;
+    };
+
+    for entry in entries.flatten() {
+        let Ok(file_type) = entry.file_type() else {
+            continue;
+        };
+        let name = entry.file_name();
+        let name = name.to_string_lossy();
+
+        if file_type.is_dir() {
+            // skip staging packages, same as the kernel
+            let staging = name.starts_with("vmdl") && name.ends_with(".tmp");
+            if depth > 0 && !staging {
+                collect_base_apks(&entry.path(), depth - 1, out);
+            }
+        } else if file_type.is_file() && name == "base.apk" {
+            out.push(entry.path());
+        }
+    }
+}
+
+#[cfg(target_os = "android")]
+fn verify_apk(apk: &std::path::Path) -> Result<ApkVerdict> {
+    use std::os::unix::ffi::OsStrExt;
+    use std::os::unix::fs::MetadataExt;
+
+    let mut f = std::fs::File::open(apk)?;
+    let meta = f.metadata()?;
+    let (cert_size, cert_sha256) = read_apk_signature(&mut f)?;
+
+    Ok(ApkVerdict {
+        path: std::ffi::CString::new(apk.as_os_str().as_bytes())?,
+        ino: meta.ino(),
+        size: meta.size() as i64,
+        mtime_sec: meta.mtime(),
+        mtime_nsec: meta.mtime_nsec() as u32,
+        cert_size,
+        cert_sha256,
+    })
+}
+
+/// Verify `apks` on all cores. Apks that fail to parse are left out, the kernel checks those itself.
+#[cfg(target_os = "android")]
+fn verify_apks(apks: &[std::path::PathBuf]) -> Vec<ApkVerdict> {
+    use std::sync::atomic::{AtomicUsize, Ordering};
+
+    let workers = std::thread::available_parallelism()
+        .map_or(1, std::num::NonZeroUsize::get)
+        .min(apks.len())
+        .max(1);
+    let next = AtomicUsize::new(0);
+
+    std::thread::scope(|s| {
+        let handles: Vec<_> = (0..workers)
+            .map(|_| {
+                s.spawn(|| {
+                    let mut verdicts = Vec::new();
+                    while let Some(apk) = apks.get(next.fetch_add(1, Ordering::Relaxed)) {
+                        match verify_apk(apk) {
+                            Ok(verdict) => verdicts.push(verdict),
+                            Err(e) => log::debug!("skip {}: {e}", apk.display()),
+                        }
+                    }
+                    verdicts
+                })
+            })
+            .collect();
+
+        handles
+            .into_iter()
+            .filter_map(|h| h.join().ok())
+            .flatten()
+            .collect()
+    })
+}
+
+/// Hash every `/data/app` base.apk in parallel and hand the verdicts to the kernel,
+/// so its manager search does not have to parse them one by one.
+#[cfg(target_os = "android")]
+pub fn submit_manager_verdicts() -> Result<()> {
+    let start = std::time::Instant::now();
+
+    let mut apks = Vec::new();
+    collect_base_apks(std::path::Path::new("/data/app"), 2, &mut apks);
+    let verdicts = verify_apks(&apks);
+
+    let mut accepted = 0;
+    for chunk in verdicts.chunks(crate::ksu_uapi::KSU_APK_VERDICTS_MAX as usize) {
+        let mut entries: Vec<_> = chunk
+            .iter()
+            .map(|v| {
+                let mut cert_sha256 = [0u8; 65];
+                let len = v.cert_sha256.len().min(cert_sha256.len() - 1);
+                cert_sha256[..len].copy_from_slice(&v.cert_sha256.as_bytes()[..len]);
+                crate::ksu_uapi::ksu_apk_verdict {
+                    path: v.path.as_ptr() as u64,
+                    ino: v.ino,
+                    size: v.size,
+                    mtime_sec: v.mtime_sec,
+                    mtime_nsec: v.mtime_nsec,
+                    cert_size: v.cert_size,
+                    cert_sha256,
+                }
+            })
+            .collect();
+        accepted += crate::ksucalls::submit_apk_verdicts(&mut entries)?;
+    }
+
+    log::info!(
+        "apk verdicts: {} apks, {} verified, {accepted} accepted in {:?}",
+        apks.len(),
+        verdicts.len(),
+        start.elapsed()
+    );
+    Ok(())
+}
@@ -272,6 +272,13 @@ enum Sepolicy {
         /// sepolicy statements
         sepolicy: String,
     },
+
+    /// Time type creation in a throwaway sepolicy transaction
+    Bench {
+        /// number of types per run
+        #[arg(default_values_t = [10, 100, 1000])]
+        counts: Vec<usize>,
+    },
 }
 
 #[derive(clap::Subcommand, Debug)]
@@ -456,25 +463,37 @@ enum Kernel {
     },
     /// Notify that module is mounted
     NotifyModuleMounted,
+    /// Verify /data/app apk signatures in parallel and pass the verdicts to the kernel
+    VerifyApks,
 }
 
 #[derive(clap::Subcommand, Debug)]
 enum UmountOp {
-    /// Add mount point to umount list
+    /// Add mount points to umount list
     Add {
-        /// mount point path
-        mnt: String,
+        /// mount point paths
+        #[arg(required = true)]
+        mnt: Vec<String>,
         /// umount flags (default: 0, MNT_DETACH: 2)
         #[arg(short, long, default_value = "0")]
         flags: u32,
     },
-    /// Delete mount point from umount list
+    /// Delete mount points from umount list
     Del {
-        /// mount point path
-        mnt: String,
+        /// mount point paths
+        #[arg(required = true)]
+        mnt: Vec<String>,
     },
     /// Wipe all entries from umount list
     Wipe,
+    /// Print umount list in umount order
+    List,
+    /// Show umount latency histograms and the most expensive entries
+    Stats {
+        /// reset the counters instead
+        #[arg(long)]
+        reset: bool,
+    },
 }
 
 #[derive(clap::Subcommand, Debug)]
@@ -483,6 +502,66 @@ enum Initrc {
     Refresh,
 }
 
+fn check_umount_results<'a>(mnts: impl Iterator<Item = &'a String>, results: &[i32]) -> Result<()> {
+    let mut failed = 0;
+    for (mnt, &ret) in mnts.zip(results) {
+        if ret != 0 {
+            log::warn!(
+                "umount list: {mnt}: {}",
+                std::io::Error::from_raw_os_error(-ret)
+            );
+            failed += 1;
+        }
+    }
+    if failed > 0 {
+        anyhow::bail!("{failed} of {} umount list entries failed", results.len());
+    }
+    Ok(())
+}
+
+fn format_ns(ns: u64) -> String {
+    match ns {
+        0..1_000 => format!("{ns}ns"),
+        1_000..1_000_000 => format!("{}us", ns / 1_000),
+        _ => format!("{}ms", ns / 1_000_000),
+    }
+}
+
+fn print_umount_stats(stats: &crate::ksu_uapi::ksu_umount_stats_cmd) {
+    for (name, hist) in [
+        ("umount pass", &stats.call_hist),
+        ("single entry", &stats.entry_hist),
+    ] {
+        println!("{name} latency:");
+        for (i, &count) in hist.iter().enumerate().filter(|(_, c)| **c > 0) {
+            let upper = if i + 1 == hist.len() {
+                "inf".to_string()
+            } else {
+                format_ns(1 << (i + 1))
+            };
+            println!("  [{:>6}, {upper:>6})  {count}", format_ns(1 << i));
+        }
+    }
+
+    println!("most expensive entries:");
+    println!(
+        "  {:>8}  {:>10}  {:>8}  {:>6}  path",
+        "calls", "total", "max", "flags"
+    );
+    for top in &stats.top[..stats.top_count as usize] {
+        // the kernel always null-terminates path
+        let path = unsafe { std::ffi::CStr::from_ptr(top.path.as_ptr()) };
+        println!(
+            "  {:>8}  {:>10}  {:>8}  {:>#6x}  {}",
+            top.calls,
+            format_ns(top.total_ns),
+            format_ns(top.max_ns),
+            top.flags,
+            path.to_string_lossy()
+        );
+    }
+}
+
 pub fn run() -> Result<()> {
     android_logger::init_once(
         Config::default()
@@ -628,6 +707,7 @@ pub fn run() -> Result<()> {
             Sepolicy::Patch { sepolicy } => crate::sepolicy::live_patch(&sepolicy),
             Sepolicy::Apply { file } => crate::sepolicy::apply_file(file),
             Sepolicy::Check { sepolicy } => crate::sepolicy::check_rule(&sepolicy),
+            Sepolicy::Bench { counts } => crate::sepolicy::bench_types(&counts),
         },
         Commands::LateLoad {
             magica,
@@ -786,14 +866,39 @@ pub fn run() -> Result<()> {
         Commands::Kernel { command } => match command {
             Kernel::NukeExt4Sysfs { mnt } => ksucalls::nuke_ext4_sysfs(&mnt),
             Kernel::Umount { command } => match command {
-                UmountOp::Add { mnt, flags } => ksucalls::umount_list_add(&mnt, flags),
-                UmountOp::Del { mnt } => ksucalls::umount_list_del(&mnt),
+                UmountOp::Add { mnt, flags } => {
+                    let entries: Vec<_> = mnt.into_iter().map(|m| (m, flags)).collect();
+                    let results = ksucalls::umount_list_add_batch(&entries)?;
+                    check_umount_results(entries.iter().map(|(m, _)| m), &results)
+                }
+                UmountOp::Del { mnt } => {
+                    // deleting a path that isn't listed was never an error
+                    let results: Vec<_> = ksucalls::umount_list_del_batch(&mnt)?
+                        .into_iter()
+                        .map(|ret| if ret == -libc::ENOENT { 0 } else { ret })
+                        .collect();
+                    check_umount_results(mnt.iter(), &results)
+                }
                 UmountOp::Wipe => ksucalls::umount_list_wipe().map_err(Into::into),
+                UmountOp::Stats { reset: true } => {
+                    ksucalls::umount_stats_reset().map_err(Into::into)
+                }
+                UmountOp::Stats { reset: false } => {
+                    print_umount_stats(&ksucalls::umount_stats()?);
+                    Ok(())
+                }
+                UmountOp::List => {
+                    for (mnt, flags) in ksucalls::umount_list_get()? {
+                        println!("{mnt} 0x{flags:x}");
+                    }
+                    Ok(())
+                }
             },
             Kernel::NotifyModuleMounted => {
                 ksucalls::report_module_mounted();
                 Ok(())
             }
+            Kernel::VerifyApks => apk_sign::submit_manager_verdicts(),
         },
         Commands::Initrc { command } => match command {
             Initrc::Refresh => regenerate_preinit_rc(),
@@ -79,14 +79,18 @@ fn set_kernel_feature(feature_id: FeatureId, value: u64) -> Result<()> {
     crate::ksucalls::set_feature(feature_id as u32, value)
         .with_context(|| format!("Failed to set feature {} to {value}", feature_id.name()))?;
 
+    feature_set_hook(feature_id, value);
+    Ok(())
+}
+
+// userspace side of a feature the kernel just took
+fn feature_set_hook(feature_id: FeatureId, value: u64) {
     if feature_id == FeatureId::Sulog
         && value != 0
         && let Err(err) = sulog::ensure_sulogd_running()
     {
         log::warn!("failed to ensure sulogd is running after feature init: {err:#}");
     }
-
-    Ok(())
 }
 
 pub fn load_binary_config() -> Result<HashMap<u32, u64>> {
@@ -177,27 +181,31 @@ pub fn save_binary_config(features: &HashMap<u32, u64>) -> Result<()> {
 pub fn apply_config(features: &HashMap<u32, u64>) {
     log::info!("Applying feature configuration to kernel...");
 
+    // the whole config goes in as one batch, this runs on the boot path
+    let entries: Vec<_> = features.iter().map(|(&id, &value)| (id, value)).collect();
+    let results = match crate::ksucalls::set_features(&entries) {
+        Ok(results) => results,
+        Err(e) => {
+            log::warn!("Failed to set features: {e}");
+            return;
+        }
+    };
+
     let mut applied = 0;
-    for (&id, &value) in features {
-        match FeatureId::from_u32(id) {
-            Some(feature_id) => match set_kernel_feature(feature_id, value) {
-                Ok(()) => {
-                    log::info!("Set feature {} to {value}", feature_id.name());
-                    applied += 1;
+    for (&(id, value), result) in entries.iter().zip(results) {
+        let feature_id = FeatureId::from_u32(id);
+        let name = feature_id.map_or_else(|| id.to_string(), |f| f.name().to_string());
+        match result {
+            Ok(()) => {
+                log::info!("Set feature {name} to {value}");
+                applied += 1;
+                if let Some(feature_id) = feature_id {
+                    feature_set_hook(feature_id, value);
                 }
-                Err(e) => {
-                    log::warn!("Failed to set feature {}: {e}", feature_id.name());
-                }
-            },
-            None => match crate::ksucalls::set_feature(id, value) {
-                Ok(()) => {
-                    log::info!("Set feature {id} to {value}");
-                    applied += 1;
-                }
-                Err(e) => {
-                    log::warn!("Failed to set feature {id}: {e}");
-                }
-            },
+            }
+            Err(e) => {
+                log::warn!("Failed to set feature {name}: {e}");
+            }
         }
     }
 
@@ -319,9 +327,15 @@ pub fn list_features() {
         FeatureId::SelinuxHide,
     ];
 
-    for feature_id in &all_features {
-        let id = *feature_id as u32;
-        let (value, supported) = crate::ksucalls::get_feature(id).unwrap_or((0, false));
+    let ids = all_features.map(|f| f as u32);
+    let states = crate::ksucalls::get_features(&ids).unwrap_or_default();
+
+    for (i, feature_id) in all_features.iter().enumerate() {
+        let id = ids[i];
+        let (value, supported) = match states.get(i) {
+            Some(Ok(state)) => *state,
+            _ => (0, false),
+        };
 
         let status = if !supported {
             "NOT_SUPPORTED".to_string()
@@ -382,9 +396,11 @@ pub fn save_config() -> Result<()> {
         FeatureId::SelinuxHide,
     ];
 
-    for feature_id in &all_features {
-        let id = *feature_id as u32;
-        if let Ok((value, supported)) = crate::ksucalls::get_feature(id)
+    let ids = all_features.map(|f| f as u32);
+    let states = crate::ksucalls::get_features(&ids).unwrap_or_default();
+
+    for ((feature_id, &id), state) in all_features.iter().zip(&ids).zip(states) {
+        if let Ok((value, supported)) = state
             && supported
         {
             features.insert(id, value);
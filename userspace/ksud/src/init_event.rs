@@ -21,6 +21,21 @@ pub fn on_post_data_fs() -> Result<()> {
 
     ksucalls::report_post_fs_data();
 
+    // warm the kernel apk verdict cache before packages.list shows up, from a
+    // detached daemon so the blocking post-fs-data exec does not wait for it
+    match utils::create_daemon(false) {
+        Ok(true) => {
+            if let Err(e) = crate::apk_sign::submit_manager_verdicts() {
+                warn!("submit apk verdicts failed: {e}");
+            }
+            unsafe {
+                _exit(0);
+            }
+        }
+        Ok(false) => {}
+        Err(e) => warn!("spawn apk verdict daemon failed: {e}"),
+    }
+
     utils::umask(0);
 
     // Clear all temporary module configs early
@@ -30,7 +30,23 @@ fn scan_driver_fd() -> Option<RawFd> {
 
 // Get cached driver fd
 fn init_driver_fd() -> Option<RawFd> {
-    let fd = scan_driver_fd();
+    // kernels that know the query overwrite fd with the driver fd or -1,
+    // older ones leave it alone and we fall back to scanning /proc/self/fd
+    let mut fd = i32::MIN;
+    unsafe {
+        libc::syscall(
+            libc::SYS_reboot,
+            ksu_uapi::KSU_INSTALL_MAGIC1,
+            ksu_uapi::KSU_QUERY_FD_MAGIC2,
+            0,
+            &mut fd,
+        );
+    };
+    let fd = match fd {
+        i32::MIN => scan_driver_fd(),
+        fd if fd >= 0 => Some(fd),
+        _ => None,
+    };
     if fd.is_none() {
         let mut fd = -1;
         unsafe {
@@ -153,6 +169,25 @@ pub fn set_sepolicy(payload: *const u8, payload_len: u64) -> std::io::Result<i32
     ksuctl(ksu_uapi::KSU_IOCTL_SET_SEPOLICY, &raw mut ioctl_cmd)
 }
 
+/// Like `set_sepolicy`, and fills `results` with one `KSU_SEPOLICY_RESULT_*` per command
+pub fn set_sepolicy_ex(payload: &[u8], results: &mut [u8]) -> std::io::Result<i32> {
+    let mut ioctl_cmd = ksu_uapi::ksu_set_sepolicy_ex_cmd {
+        data_len: payload.len() as u64,
+        data: payload.as_ptr() as u64,
+        results: results.as_mut_ptr() as u64,
+        results_len: results.len() as u32,
+        reserved: 0,
+    };
+
+    ksuctl(ksu_uapi::KSU_IOCTL_SET_SEPOLICY_EX, &raw mut ioctl_cmd)
+}
+
+/// Begin, commit or abort a sepolicy transaction, see `KSU_SEPOLICY_TXN_*`
+pub fn sepolicy_txn(op: u32) -> std::io::Result<i32> {
+    let mut cmd = ksu_uapi::ksu_sepolicy_txn_cmd { op };
+    ksuctl(ksu_uapi::KSU_IOCTL_SEPOLICY_TXN, &raw mut cmd)
+}
+
 /// Get feature value and support status from kernel
 /// Returns (value, supported)
 pub fn get_feature(feature_id: u32) -> std::io::Result<(u64, bool)> {
@@ -165,6 +200,104 @@ pub fn get_feature(feature_id: u32) -> std::io::Result<(u64, bool)> {
     Ok((cmd.value, cmd.supported != 0))
 }
 
+/// Run several supercalls with one ioctl, returns each command's result.
+/// Kernels without KSU_IOCTL_BATCH get one ioctl per command
+fn ksuctl_batch(cmds: &[(u32, u64)]) -> std::io::Result<Vec<i32>> {
+    let mut results = Vec::with_capacity(cmds.len());
+
+    for chunk in cmds.chunks(ksu_uapi::KSU_IOCTL_BATCH_MAX as usize) {
+        let mut ents: Vec<_> = chunk
+            .iter()
+            .map(|&(cmd, arg)| ksu_uapi::ksu_ioctl_batch_entry {
+                cmd,
+                result: 0,
+                arg,
+            })
+            .collect();
+        let mut batch = ksu_uapi::ksu_ioctl_batch_cmd {
+            entries: ents.as_mut_ptr() as u64,
+            count: ents.len() as u32,
+            flags: 0,
+        };
+        match ksuctl(ksu_uapi::KSU_IOCTL_BATCH, &raw mut batch) {
+            Ok(_) => results.extend(ents.iter().map(|e| e.result)),
+            // kernel predates BATCH
+            Err(e) if e.raw_os_error() == Some(libc::ENOTTY) => {
+                for &(cmd, arg) in chunk {
+                    let ret = ksuctl(cmd, arg as *mut libc::c_void);
+                    results.push(ret.unwrap_or_else(|e| -e.raw_os_error().unwrap_or(libc::EIO)));
+                }
+            }
+            Err(e) => return Err(e),
+        }
+    }
+
+    Ok(results)
+}
+
+/// Get value and support status of several features with one ioctl
+pub fn get_features(feature_ids: &[u32]) -> std::io::Result<Vec<std::io::Result<(u64, bool)>>> {
+    let mut cmds: Vec<_> = feature_ids
+        .iter()
+        .map(|&feature_id| ksu_uapi::ksu_get_feature_cmd {
+            feature_id,
+            value: 0,
+            supported: 0,
+        })
+        .collect();
+    let calls: Vec<_> = cmds
+        .iter_mut()
+        .map(|cmd| {
+            (
+                ksu_uapi::KSU_IOCTL_GET_FEATURE,
+                std::ptr::from_mut(cmd) as u64,
+            )
+        })
+        .collect();
+    let results = ksuctl_batch(&calls)?;
+
+    Ok(cmds
+        .iter()
+        .zip(results)
+        .map(|(cmd, ret)| {
+            if ret < 0 {
+                Err(std::io::Error::from_raw_os_error(-ret))
+            } else {
+                Ok((cmd.value, cmd.supported != 0))
+            }
+        })
+        .collect())
+}
+
+/// Set several features with one ioctl, `(feature_id, value)` each
+pub fn set_features(features: &[(u32, u64)]) -> std::io::Result<Vec<std::io::Result<()>>> {
+    let mut cmds: Vec<_> = features
+        .iter()
+        .map(|&(feature_id, value)| ksu_uapi::ksu_set_feature_cmd { feature_id, value })
+        .collect();
+    let calls: Vec<_> = cmds
+        .iter_mut()
+        .map(|cmd| {
+            (
+                ksu_uapi::KSU_IOCTL_SET_FEATURE,
+                std::ptr::from_mut(cmd) as u64,
+            )
+        })
+        .collect();
+    let results = ksuctl_batch(&calls)?;
+
+    Ok(results
+        .into_iter()
+        .map(|ret| {
+            if ret < 0 {
+                Err(std::io::Error::from_raw_os_error(-ret))
+            } else {
+                Ok(())
+            }
+        })
+        .collect())
+}
+
 /// Set feature value in kernel
 pub fn set_feature(feature_id: u32, value: u64) -> std::io::Result<()> {
     let mut cmd = ksu_uapi::ksu_set_feature_cmd { feature_id, value };
@@ -251,28 +384,159 @@ pub fn umount_list_wipe() -> std::io::Result<()> {
     Ok(())
 }
 
-/// Add mount point to umount list
-pub fn umount_list_add(path: &str, flags: u32) -> anyhow::Result<()> {
-    let c_path = std::ffi::CString::new(path)?;
-    let mut cmd = ksu_uapi::ksu_add_try_umount_cmd {
-        arg: c_path.as_ptr() as u64,
-        flags,
-        mode: ksu_uapi::KSU_UMOUNT_ADD,
+/// Add (with flags) or delete many mount points with one ioctl per chunk,
+/// returns 0 or -errno for every path. Kernels without the batch call get one
+/// ioctl per path
+fn umount_list_batch(mode: u8, entries: &[(String, u32)]) -> anyhow::Result<Vec<i32>> {
+    let c_paths = entries
+        .iter()
+        .map(|(path, _)| std::ffi::CString::new(path.as_str()))
+        .collect::<Result<Vec<_>, _>>()?;
+    let mut results = Vec::with_capacity(entries.len());
+
+    for (paths, entries) in c_paths
+        .chunks(ksu_uapi::KSU_TRY_UMOUNT_BATCH_MAX as usize)
+        .zip(entries.chunks(ksu_uapi::KSU_TRY_UMOUNT_BATCH_MAX as usize))
+    {
+        let mut ents: Vec<_> = paths
+            .iter()
+            .zip(entries)
+            .map(|(c_path, (_, flags))| ksu_uapi::ksu_try_umount_entry {
+                path: c_path.as_ptr() as u64,
+                flags: *flags,
+                result: 0,
+            })
+            .collect();
+        let mut cmd = ksu_uapi::ksu_try_umount_batch_cmd {
+            entries: ents.as_mut_ptr() as u64,
+            count: ents.len() as u32,
+            mode: u32::from(mode),
+            done: 0,
+            reserved: 0,
+        };
+        match ksuctl(ksu_uapi::KSU_IOCTL_TRY_UMOUNT_BATCH, &raw mut cmd) {
+            Ok(_) => results.extend(ents.iter().map(|e| e.result)),
+            // kernel predates TRY_UMOUNT_BATCH
+            Err(e) if e.raw_os_error() == Some(libc::ENOTTY) => {
+                for ent in &mut ents {
+                    let mut cmd = ksu_uapi::ksu_add_try_umount_cmd {
+                        arg: ent.path,
+                        flags: ent.flags,
+                        mode,
+                    };
+                    let ret = ksuctl(ksu_uapi::KSU_IOCTL_ADD_TRY_UMOUNT, &raw mut cmd);
+                    results
+                        .push(ret.map_or_else(|e| -e.raw_os_error().unwrap_or(libc::EIO), |_| 0));
+                }
+            }
+            Err(e) => return Err(e.into()),
+        }
+    }
+
+    Ok(results)
+}
+
+/// Add mount points to umount list, returns 0 or -errno for every entry
+pub fn umount_list_add_batch(entries: &[(String, u32)]) -> anyhow::Result<Vec<i32>> {
+    umount_list_batch(ksu_uapi::KSU_UMOUNT_ADD, entries)
+}
+
+/// Delete mount points from umount list, returns 0 or -errno for every path
+pub fn umount_list_del_batch(paths: &[String]) -> anyhow::Result<Vec<i32>> {
+    let entries: Vec<_> = paths.iter().map(|path| (path.clone(), 0)).collect();
+    umount_list_batch(ksu_uapi::KSU_UMOUNT_DEL, &entries)
+}
+
+/// Read the umount list as (path, flags) in umount order
+pub fn umount_list_get() -> std::io::Result<Vec<(String, u32)>> {
+    let mut buf: Vec<u8> = Vec::new();
+    loop {
+        let mut cmd = ksu_uapi::ksu_get_try_umount_list_cmd {
+            buf: buf.as_mut_ptr() as u64,
+            buf_size: buf.len() as u32,
+            count: 0,
+            total_size: 0,
+            reserved: 0,
+        };
+        ksuctl(ksu_uapi::KSU_IOCTL_GET_TRY_UMOUNT_LIST, &raw mut cmd)?;
+
+        // the list may have grown between the two calls
+        if cmd.total_size as usize > buf.len() {
+            buf.resize(cmd.total_size as usize, 0);
+            continue;
+        }
+
+        let hdr_size = std::mem::size_of::<ksu_uapi::ksu_try_umount_list_entry>();
+        let list = (0..cmd.count as usize)
+            .map(|i| {
+                let hdr = &buf[i * hdr_size..(i + 1) * hdr_size];
+                let offset = u32::from_ne_bytes([hdr[0], hdr[1], hdr[2], hdr[3]]) as usize;
+                let flags = u32::from_ne_bytes([hdr[4], hdr[5], hdr[6], hdr[7]]);
+                let path = std::ffi::CStr::from_bytes_until_nul(&buf[offset..])
+                    .map_or_else(|_| String::new(), |p| p.to_string_lossy().into_owned());
+                (path, flags)
+            })
+            .collect();
+        return Ok(list);
+    }
+}
+
+/// List every process holding a KernelSU fd, as `(pid, fd, kind)`
+pub fn fd_holders() -> std::io::Result<Vec<(i32, i32, u32)>> {
+    let empty = ksu_uapi::ksu_fd_holder {
+        pid: 0,
+        fd: 0,
+        kind: 0,
+        creator: 0,
     };
-    ksuctl(ksu_uapi::KSU_IOCTL_ADD_TRY_UMOUNT, &raw mut cmd)?;
+    let mut buf = vec![empty; 64];
+    loop {
+        let mut cmd = ksu_uapi::ksu_get_fd_holders_cmd {
+            buf: buf.as_mut_ptr() as u64,
+            buf_count: buf.len() as u32,
+            count: 0,
+            total: 0,
+            live: 0,
+        };
+        ksuctl(ksu_uapi::KSU_IOCTL_GET_FD_HOLDERS, &raw mut cmd)?;
+
+        // more holders than room, the kernel caps a single call at KSU_FD_HOLDERS_MAX
+        if cmd.total > cmd.count && buf.len() < ksu_uapi::KSU_FD_HOLDERS_MAX as usize {
+            buf.resize(cmd.total.min(ksu_uapi::KSU_FD_HOLDERS_MAX) as usize, empty);
+            continue;
+        }
+
+        buf.truncate(cmd.count as usize);
+        return Ok(buf.iter().map(|h| (h.pid as i32, h.fd, h.kind)).collect());
+    }
+}
+
+/// Read the umount latency histograms and the most expensive entries
+pub fn umount_stats() -> std::io::Result<ksu_uapi::ksu_umount_stats_cmd> {
+    // integers and arrays only, all zeroes is a valid value
+    let mut cmd: ksu_uapi::ksu_umount_stats_cmd = unsafe { std::mem::zeroed() };
+    cmd.op = ksu_uapi::KSU_UMOUNT_STATS_GET;
+    ksuctl(ksu_uapi::KSU_IOCTL_UMOUNT_STATS, &raw mut cmd)?;
+    Ok(cmd)
+}
+
+/// Reset the umount latency histograms and entry costs
+pub fn umount_stats_reset() -> std::io::Result<()> {
+    // the kernel only reads op for a reset
+    let mut op = ksu_uapi::KSU_UMOUNT_STATS_RESET;
+    ksuctl(ksu_uapi::KSU_IOCTL_UMOUNT_STATS, &raw mut op)?;
     Ok(())
 }
 
-/// Delete mount point from umount list
-pub fn umount_list_del(path: &str) -> anyhow::Result<()> {
-    let c_path = std::ffi::CString::new(path)?;
-    let mut cmd = ksu_uapi::ksu_add_try_umount_cmd {
-        arg: c_path.as_ptr() as u64,
-        flags: 0,
-        mode: ksu_uapi::KSU_UMOUNT_DEL,
+/// Hand apk signature verdicts to the kernel, returns how many it took
+pub fn submit_apk_verdicts(entries: &mut [ksu_uapi::ksu_apk_verdict]) -> std::io::Result<u32> {
+    let mut cmd = ksu_uapi::ksu_submit_apk_verdicts_cmd {
+        entries: entries.as_mut_ptr() as u64,
+        count: entries.len() as u32,
+        accepted: 0,
     };
-    ksuctl(ksu_uapi::KSU_IOCTL_ADD_TRY_UMOUNT, &raw mut cmd)?;
-    Ok(())
+    ksuctl(ksu_uapi::KSU_IOCTL_SUBMIT_APK_VERDICTS, &raw mut cmd)?;
+    Ok(cmd.accepted)
 }
 
 /// Set current process's process group to init_group (pgid = 0)
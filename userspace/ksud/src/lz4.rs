@@ -0,0 +1,84 @@
+//! Minimal LZ4 block format encoder used for sealed sulog segments.
+//!
+//! Only the raw block format is produced (no frame header, no checksums);
+//! callers are responsible for recording the uncompressed length.
+
+const MIN_MATCH: usize = 4;
+const LAST_LITERALS: usize = 5;
+const MF_LIMIT: usize = 12;
+const MAX_DISTANCE: usize = 0xffff;
+const HASH_LOG: u32 = 12;
+
+const fn read_u32(src: &[u8], pos: usize) -> u32 {
+    u32::from_le_bytes([src[pos], src[pos + 1], src[pos + 2], src[pos + 3]])
+}
+
+const fn hash(sequence: u32) -> usize {
+    (sequence.wrapping_mul(2_654_435_761) >> (32 - HASH_LOG)) as usize
+}
+
+fn write_length(out: &mut Vec<u8>, mut len: usize) {
+    while len >= 255 {
+        out.push(255);
+        len -= 255;
+    }
+    out.push(len as u8);
+}
+
+fn write_literals(out: &mut Vec<u8>, literals: &[u8], match_len: Option<usize>) {
+    let lit_len = literals.len();
+    let match_token = match_len.map_or(0, |len| (len - MIN_MATCH).min(15));
+    out.push(((lit_len.min(15) << 4) | match_token) as u8);
+    if lit_len >= 15 {
+        write_length(out, lit_len - 15);
+    }
+    out.extend_from_slice(literals);
+}
+
+/// Compress `src` into a single LZ4 block.
+pub fn compress_block(src: &[u8]) -> Vec<u8> {
+    let mut out = Vec::with_capacity(src.len() + src.len() / 255 + 16);
+    let mut table = vec![0usize; 1 << HASH_LOG];
+    let mut anchor = 0usize;
+    let mut pos = 0usize;
+
+    if src.len() > MF_LIMIT {
+        let match_limit = src.len() - MF_LIMIT;
+        let extend_limit = src.len() - LAST_LITERALS;
+        while pos < match_limit {
+            let sequence = read_u32(src, pos);
+            let slot = hash(sequence);
+            let candidate = table[slot];
+            table[slot] = pos + 1;
+
+            if candidate == 0 {
+                pos += 1;
+                continue;
+            }
+            let candidate = candidate - 1;
+            if pos - candidate > MAX_DISTANCE || read_u32(src, candidate) != sequence {
+                pos += 1;
+                continue;
+            }
+
+            let mut match_len = MIN_MATCH;
+            while pos + match_len < extend_limit
+                && src[candidate + match_len] == src[pos + match_len]
+            {
+                match_len += 1;
+            }
+
+            write_literals(&mut out, &src[anchor..pos], Some(match_len));
+            out.extend_from_slice(&((pos - candidate) as u16).to_le_bytes());
+            if match_len - MIN_MATCH >= 15 {
+                write_length(&mut out, match_len - MIN_MATCH - 15);
+            }
+
+            pos += match_len;
+            anchor = pos;
+        }
+    }
+
+    write_literals(&mut out, &src[anchor..], None);
+    out
+}
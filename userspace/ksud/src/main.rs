@@ -29,6 +29,8 @@ mod ksucalls;
 #[cfg(target_os = "android")]
 mod late_load;
 #[cfg(target_os = "android")]
+mod lz4;
+#[cfg(target_os = "android")]
 mod magica;
 #[cfg(target_os = "android")]
 mod metamodule;
@@ -1,7 +1,7 @@
 #[allow(clippy::wildcard_imports)]
 use crate::utils::*;
 use crate::{
-    assets, defs, ksucalls, metamodule,
+    assets, defs, ksu_uapi, ksucalls, metamodule,
     restorecon::{restore_syscon, setsyscon},
     sepolicy,
 };
@@ -164,19 +164,52 @@ fn foreach_active_module(f: impl FnMut(&Path) -> Result<()>) -> Result<()> {
     foreach_module(Active, f)
 }
 
-pub fn load_sepolicy_rule() -> Result<()> {
+fn apply_module_sepolicy_rules() -> Result<()> {
+    let mut rule_files = vec![];
     foreach_active_module(|path| {
         let rule_file = path.join("sepolicy.rule");
-        if !rule_file.exists() {
-            return Ok(());
+        if rule_file.exists() {
+            rule_files.push(rule_file);
         }
+        Ok(())
+    })?;
+
+    match sepolicy::apply_files_cached(&rule_files, Path::new(defs::SEPOLICY_CACHE_PATH)) {
+        Ok(true) => return Ok(()),
+        Ok(false) => {}
+        Err(e) => warn!("precompiled sepolicy rules failed: {e}, applying them one by one"),
+    }
+
+    for rule_file in &rule_files {
         info!("load policy: {}", &rule_file.display());
 
-        if sepolicy::apply_file(&rule_file).is_err() {
+        if sepolicy::apply_file(rule_file).is_err() {
             warn!("Failed to load sepolicy.rule for {}", &rule_file.display());
         }
-        Ok(())
-    })?;
+    }
+    Ok(())
+}
+
+pub fn load_sepolicy_rule() -> Result<()> {
+    // one policy swap and avc reset for all modules instead of one per module
+    if let Err(e) = ksucalls::sepolicy_txn(ksu_uapi::KSU_SEPOLICY_TXN_BEGIN) {
+        info!("sepolicy transaction unavailable: {e}");
+        return apply_module_sepolicy_rules();
+    }
+
+    if let Err(e) = apply_module_sepolicy_rules() {
+        let _ = ksucalls::sepolicy_txn(ksu_uapi::KSU_SEPOLICY_TXN_ABORT);
+        return Err(e);
+    }
+
+    match ksucalls::sepolicy_txn(ksu_uapi::KSU_SEPOLICY_TXN_COMMIT) {
+        Ok(applied) => info!("sepolicy transaction committed, {applied} rules applied"),
+        Err(e) => {
+            // the policy was replaced under us, nothing was applied
+            warn!("sepolicy transaction commit failed: {e}, applying rules one by one");
+            apply_module_sepolicy_rules()?;
+        }
+    }
 
     Ok(())
 }
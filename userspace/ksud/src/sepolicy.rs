@@ -7,7 +7,15 @@ use nom::{
     character::complete::{space0, space1},
     combinator::map,
 };
-use std::{path::Path, vec};
+use std::{
+    collections::HashMap,
+    os::unix::ffi::OsStrExt,
+    path::{Path, PathBuf},
+    sync::OnceLock,
+    vec,
+};
+
+use crate::{defs, utils::getprop};
 
 type SeObject<'a> = Vec<&'a str>;
 
@@ -408,17 +416,35 @@ struct AtomicStatement {
     sepol7: PolicyObject,
 }
 
+impl AtomicStatement {
+    const fn args(&self) -> [&PolicyObject; 7] {
+        [
+            &self.sepol1,
+            &self.sepol2,
+            &self.sepol3,
+            &self.sepol4,
+            &self.sepol5,
+            &self.sepol6,
+            &self.sepol7,
+        ]
+    }
+}
+
+fn normal_perm_subcmd(op: &str) -> u32 {
+    match op {
+        "allow" => crate::ksu_uapi::KSU_SEPOLICY_SUBCMD_NORMAL_PERM_ALLOW,
+        "deny" => crate::ksu_uapi::KSU_SEPOLICY_SUBCMD_NORMAL_PERM_DENY,
+        "auditallow" => crate::ksu_uapi::KSU_SEPOLICY_SUBCMD_NORMAL_PERM_AUDITALLOW,
+        "dontaudit" => crate::ksu_uapi::KSU_SEPOLICY_SUBCMD_NORMAL_PERM_DONTAUDIT,
+        _ => 0,
+    }
+}
+
 impl<'a> TryFrom<&'a NormalPerm<'a>> for Vec<AtomicStatement> {
     type Error = anyhow::Error;
     fn try_from(perm: &'a NormalPerm<'a>) -> Result<Self> {
         let mut result = vec![];
-        let subcmd = match perm.op {
-            "allow" => crate::ksu_uapi::KSU_SEPOLICY_SUBCMD_NORMAL_PERM_ALLOW,
-            "deny" => crate::ksu_uapi::KSU_SEPOLICY_SUBCMD_NORMAL_PERM_DENY,
-            "auditallow" => crate::ksu_uapi::KSU_SEPOLICY_SUBCMD_NORMAL_PERM_AUDITALLOW,
-            "dontaudit" => crate::ksu_uapi::KSU_SEPOLICY_SUBCMD_NORMAL_PERM_DONTAUDIT,
-            _ => 0,
-        };
+        let subcmd = normal_perm_subcmd(perm.op);
         for &s in &perm.source {
             for &t in &perm.target {
                 for &c in &perm.class {
@@ -683,17 +709,7 @@ fn append_atomic_statement(payload: &mut Vec<u8>, statement: &AtomicStatement) -
     payload.extend_from_slice(&statement.cmd.to_ne_bytes());
     payload.extend_from_slice(&statement.subcmd.to_ne_bytes());
 
-    let args = [
-        &statement.sepol1,
-        &statement.sepol2,
-        &statement.sepol3,
-        &statement.sepol4,
-        &statement.sepol5,
-        &statement.sepol6,
-        &statement.sepol7,
-    ];
-
-    for object in args.iter().take(expected_argc) {
+    for object in statement.args().into_iter().take(expected_argc) {
         encode_policy_object(payload, object)?;
     }
 
@@ -708,6 +724,139 @@ fn serialize_atomic_statements(statements: &[AtomicStatement]) -> Result<Vec<u8>
     Ok(payload)
 }
 
+/// string table of a v2 batch, every distinct name is sent once
+#[derive(Default)]
+struct StringTable<'a> {
+    strings: Vec<&'a [u8]>,
+    indices: HashMap<&'a [u8], u16>,
+}
+
+impl<'a> StringTable<'a> {
+    fn intern_bytes(&mut self, value: &'a [u8]) -> Result<u16> {
+        use crate::ksu_uapi::KSU_SEPOLICY_V2_ALL;
+
+        if value.is_empty() {
+            return Ok(KSU_SEPOLICY_V2_ALL);
+        }
+        if let Some(&index) = self.indices.get(value) {
+            return Ok(index);
+        }
+        let index = u16::try_from(self.strings.len())
+            .ok()
+            .filter(|&index| index != KSU_SEPOLICY_V2_ALL)
+            .context("too many distinct names for a v2 batch")?;
+        self.strings.push(value);
+        self.indices.insert(value, index);
+        Ok(index)
+    }
+
+    fn intern(&mut self, object: &'a PolicyObject) -> Result<u16> {
+        match object {
+            PolicyObject::One(value) => self.intern_bytes(value),
+            PolicyObject::All | PolicyObject::None => Ok(crate::ksu_uapi::KSU_SEPOLICY_V2_ALL),
+        }
+    }
+
+    /// same rules as `PolicyObject::try_from(&str)`
+    fn intern_str(&mut self, name: &'a str) -> Result<u16> {
+        anyhow::ensure!(!name.as_bytes().contains(&0), "policy object contains NUL");
+        if name == "*" {
+            return Ok(crate::ksu_uapi::KSU_SEPOLICY_V2_ALL);
+        }
+        self.intern_bytes(name.as_bytes())
+    }
+
+    fn encode(&self, payload: &mut Vec<u8>) {
+        payload.extend_from_slice(&crate::ksu_uapi::KSU_SEPOLICY_V2_MAGIC.to_ne_bytes());
+        payload.extend_from_slice(&(self.strings.len() as u32).to_ne_bytes());
+        for value in &self.strings {
+            payload.extend_from_slice(&(value.len() as u32).to_ne_bytes());
+            payload.extend_from_slice(value);
+            payload.push(0);
+        }
+    }
+}
+
+/// a command of a v2 batch, allow-style rules keep their sets
+enum V2Command<'a> {
+    Atomic(AtomicStatement),
+    PermSet(&'a NormalPerm<'a>),
+}
+
+/// serialized batch and the number of kernel commands in it
+struct SepolicyBatch {
+    payload: Vec<u8>,
+    count: usize,
+}
+
+fn serialize_statements_v1(statements: &[PolicyStatement]) -> Result<SepolicyBatch> {
+    let policies = flatten_atomic_statements(statements)?;
+    Ok(SepolicyBatch {
+        payload: serialize_atomic_statements(&policies)?,
+        count: policies.len(),
+    })
+}
+
+/// v2 layout: a leading string table, commands refer to it by u16 index and
+/// allow/deny/auditallow/dontaudit go out as one set command instead of their
+/// cartesian product, see `KSU_SEPOLICY_V2_MAGIC`
+fn serialize_statements_v2(statements: &[PolicyStatement]) -> Result<SepolicyBatch> {
+    let mut commands = vec![];
+    for statement in statements {
+        if let PolicyStatement::NormalPerm(perm) = statement {
+            // the cartesian product of an empty set is nothing
+            if ![&perm.source, &perm.target, &perm.class, &perm.perm]
+                .iter()
+                .any(|set| set.is_empty())
+            {
+                commands.push(V2Command::PermSet(perm));
+            }
+        } else {
+            let expanded: Vec<AtomicStatement> = statement.try_into()?;
+            commands.extend(expanded.into_iter().map(V2Command::Atomic));
+        }
+    }
+
+    let mut table = StringTable::default();
+    let mut body = vec![];
+    for command in &commands {
+        match command {
+            V2Command::Atomic(statement) => {
+                let expected_argc = cmd_expected_argc(statement.cmd)
+                    .ok_or_else(|| anyhow::anyhow!("unknown sepolicy cmd {}", statement.cmd))?;
+
+                body.extend_from_slice(&statement.cmd.to_ne_bytes());
+                body.extend_from_slice(&statement.subcmd.to_ne_bytes());
+                for object in statement.args().into_iter().take(expected_argc) {
+                    body.extend_from_slice(&table.intern(object)?.to_ne_bytes());
+                }
+            }
+            V2Command::PermSet(perm) => {
+                body.extend_from_slice(
+                    &crate::ksu_uapi::KSU_SEPOLICY_CMD_NORMAL_PERM_SET.to_ne_bytes(),
+                );
+                body.extend_from_slice(&normal_perm_subcmd(perm.op).to_ne_bytes());
+                for set in [&perm.source, &perm.target, &perm.class, &perm.perm] {
+                    let len = u16::try_from(set.len()).context("sepolicy set too large")?;
+                    body.extend_from_slice(&len.to_ne_bytes());
+                    for &name in set {
+                        body.extend_from_slice(&table.intern_str(name)?.to_ne_bytes());
+                    }
+                }
+            }
+        }
+    }
+
+    let mut payload = vec![];
+    table.encode(&mut payload);
+    payload.extend_from_slice(&body);
+
+    Ok(SepolicyBatch {
+        payload,
+        count: commands.len(),
+    })
+}
+
 fn flatten_atomic_statements<'a>(
     statements: &'a [PolicyStatement<'a>],
 ) -> Result<Vec<AtomicStatement>> {
@@ -719,22 +868,100 @@ fn flatten_atomic_statements<'a>(
     Ok(policies)
 }
 
+/// Send a serialized batch, returns how many commands succeeded (applied or already present)
+fn send_rules_batch(payload: &[u8], count: usize) -> std::io::Result<i32> {
+    use crate::ksu_uapi::{
+        KSU_SEPOLICY_RESULT_APPLIED, KSU_SEPOLICY_RESULT_FAILED, KSU_SEPOLICY_RESULT_NOOP,
+    };
+
+    let mut results = vec![0u8; count];
+    match crate::ksucalls::set_sepolicy_ex(payload, &mut results) {
+        Ok(ret) => {
+            let mut tally = [0usize; 3];
+            for &r in &results {
+                match r {
+                    KSU_SEPOLICY_RESULT_APPLIED => tally[0] += 1,
+                    KSU_SEPOLICY_RESULT_NOOP => tally[1] += 1,
+                    KSU_SEPOLICY_RESULT_FAILED => tally[2] += 1,
+                    _ => {}
+                }
+            }
+            log::debug!(
+                "sepolicy batch: {} applied, {} already present, {} failed",
+                tally[0],
+                tally[1],
+                tally[2]
+            );
+            Ok(ret)
+        }
+        // kernel predates SET_SEPOLICY_EX
+        Err(e) if e.raw_os_error() == Some(libc::ENOTTY) => {
+            crate::ksucalls::set_sepolicy(payload.as_ptr(), payload.len() as u64)
+        }
+        Err(e) => Err(e),
+    }
+}
+
+static SEPOLICY_V2: OnceLock<bool> = OnceLock::new();
+
+/// Whether the kernel takes v2 batches, probed once with a batch holding no
+/// strings and no commands. Kernels with v2 answer it without touching the
+/// policy, older ones reject the magic as an unknown first command.
+/// A real batch failing with EINVAL says nothing about v2, pre-5.10 kernels
+/// may have applied part of it by then.
+fn kernel_takes_v2() -> bool {
+    *SEPOLICY_V2.get_or_init(|| {
+        let Ok(probe) = serialize_statements_v2(&[]) else {
+            return false;
+        };
+        match send_rules_batch(&probe.payload, 0) {
+            Ok(_) => true,
+            Err(e) => {
+                log::info!("kernel takes no v2 sepolicy batches ({e}), using v1");
+                false
+            }
+        }
+    })
+}
+
+/// Serialize and send a batch as v2, falling back to v1 on kernels without it
+/// returns the kernel result and how many commands the batch was sent as,
+/// an empty batch is not sent at all
+fn send_statements(statements: &[PolicyStatement]) -> Result<(std::io::Result<i32>, usize)> {
+    if kernel_takes_v2()
+        && let Ok(batch) = serialize_statements_v2(statements)
+    {
+        if batch.count == 0 {
+            return Ok((Ok(0), 0));
+        }
+        log::debug!(
+            "sepolicy batch: {} commands, {} bytes",
+            batch.count,
+            batch.payload.len()
+        );
+        return Ok((send_rules_batch(&batch.payload, batch.count), batch.count));
+    }
+
+    let batch = serialize_statements_v1(statements)?;
+    if batch.count == 0 {
+        return Ok((Ok(0), 0));
+    }
+    Ok((send_rules_batch(&batch.payload, batch.count), batch.count))
+}
+
 fn apply_rules_batch<'a>(statements: &'a [PolicyStatement<'a>], strict: bool) -> Result<()> {
-    let policies = flatten_atomic_statements(statements)?;
-    if policies.is_empty() {
+    let (ret, count) = send_statements(statements)?;
+    if count == 0 {
         return Ok(());
     }
 
-    let payload = serialize_atomic_statements(&policies)?;
-
-    match crate::ksucalls::set_sepolicy(payload.as_ptr(), payload.len() as u64) {
+    match ret {
         Ok(applied_count) => {
             let applied_count = usize::try_from(applied_count)
                 .context("kernel returned negative sepolicy applied count")?;
-            if applied_count < policies.len() {
+            if applied_count < count {
                 let err = anyhow::anyhow!(
-                    "apply sepolicy batch partially succeeded: {applied_count}/{}",
-                    policies.len()
+                    "apply sepolicy batch partially succeeded: {applied_count}/{count}"
                 );
                 if strict {
                     return Err(err);
@@ -767,6 +994,154 @@ pub fn apply_file<P: AsRef<Path>>(path: P) -> Result<()> {
     live_patch(&input)
 }
 
+/// Time creating `count` new types in one batch, for each of `counts`.
+/// Every run goes into a sepolicy transaction that is aborted afterwards,
+/// so the live policy is never touched.
+pub fn bench_types(counts: &[usize]) -> Result<()> {
+    for &count in counts {
+        let rules = (0..count)
+            .map(|i| format!("type ksu_bench_{count}_{i} file_type"))
+            .collect::<Vec<_>>()
+            .join("\n");
+        let statements = parse_sepolicy(&rules, true)?;
+
+        crate::ksucalls::sepolicy_txn(crate::ksu_uapi::KSU_SEPOLICY_TXN_BEGIN)
+            .context("sepolicy transaction unavailable")?;
+        let start = std::time::Instant::now();
+        let result = send_statements(&statements);
+        let elapsed = start.elapsed();
+        let _ = crate::ksucalls::sepolicy_txn(crate::ksu_uapi::KSU_SEPOLICY_TXN_ABORT);
+
+        let (ret, sent) = result?;
+        let applied = ret.context("apply sepolicy batch failed")?;
+        println!("{count} types: {applied}/{sent} commands in {elapsed:?}");
+    }
+    Ok(())
+}
+
+const RULES_CACHE_MAGIC: &[u8; 4] = b"KSPC";
+
+/// Key of a compiled rule cache: the rule files themselves, the base policy
+/// (an OTA changes the build fingerprints) and the ksud that serialized them.
+/// Names are still resolved by the kernel, so a stale key costs a reparse,
+/// never a wrong rule.
+fn rules_cache_key(inputs: &[(PathBuf, String)]) -> String {
+    let mut key = vec![];
+    for part in [
+        Some(defs::VERSION_CODE.to_string()),
+        getprop("ro.build.fingerprint"),
+        getprop("ro.vendor.build.fingerprint"),
+    ] {
+        key.extend_from_slice(part.unwrap_or_default().as_bytes());
+        key.push(0);
+    }
+    for (path, rules) in inputs {
+        key.extend_from_slice(path.as_os_str().as_bytes());
+        key.push(0);
+        key.extend_from_slice(&(rules.len() as u64).to_le_bytes());
+        key.extend_from_slice(rules.as_bytes());
+    }
+    sha256::digest(&key)
+}
+
+// [magic][key][u32 count][v2 payload]
+fn load_rules_cache(cache: &Path, key: &str) -> Option<SepolicyBatch> {
+    let data = std::fs::read(cache).ok()?;
+    let rest = data
+        .strip_prefix(RULES_CACHE_MAGIC)?
+        .strip_prefix(key.as_bytes())?;
+    let (count, payload) = rest.split_first_chunk::<4>()?;
+    Some(SepolicyBatch {
+        payload: payload.to_vec(),
+        count: u32::from_le_bytes(*count) as usize,
+    })
+}
+
+fn store_rules_cache(cache: &Path, key: &str, batch: &SepolicyBatch) -> Result<()> {
+    let count = u32::try_from(batch.count).context("sepolicy batch too large")?;
+    let mut data =
+        Vec::with_capacity(RULES_CACHE_MAGIC.len() + key.len() + 4 + batch.payload.len());
+    data.extend_from_slice(RULES_CACHE_MAGIC);
+    data.extend_from_slice(key.as_bytes());
+    data.extend_from_slice(&count.to_le_bytes());
+    data.extend_from_slice(&batch.payload);
+
+    let tmp = cache.with_extension("tmp");
+    std::fs::write(&tmp, &data)?;
+    std::fs::rename(&tmp, cache)?;
+    Ok(())
+}
+
+/// Apply rule files as one v2 batch, reusing the batch compiled on an earlier
+/// boot when none of its inputs changed, so boot skips parsing entirely.
+/// Returns false if the kernel takes no v2 batches, the caller should then
+/// apply the files one by one.
+pub fn apply_files_cached(files: &[PathBuf], cache: &Path) -> Result<bool> {
+    if files.is_empty() {
+        return Ok(true);
+    }
+    if !kernel_takes_v2() {
+        return Ok(false);
+    }
+
+    let mut inputs = vec![];
+    for file in files {
+        match std::fs::read_to_string(file) {
+            Ok(rules) => inputs.push((file.clone(), rules)),
+            Err(e) => log::warn!("Failed to read {}: {e}", file.display()),
+        }
+    }
+    let key = rules_cache_key(&inputs);
+
+    let cached = load_rules_cache(cache, &key);
+    let hit = cached.is_some();
+    let batch = if let Some(batch) = cached {
+        batch
+    } else {
+        let mut statements = vec![];
+        for (path, rules) in &inputs {
+            match parse_sepolicy(rules.trim(), false) {
+                Ok(parsed) => statements.extend(parsed),
+                Err(e) => log::warn!("Failed to parse {}: {e}", path.display()),
+            }
+        }
+        serialize_statements_v2(&statements)?
+    };
+    log::info!(
+        "sepolicy rules: {} files, {} commands, {} bytes, cache {}",
+        inputs.len(),
+        batch.count,
+        batch.payload.len(),
+        if hit { "hit" } else { "miss" }
+    );
+
+    if batch.count != 0 {
+        match send_rules_batch(&batch.payload, batch.count) {
+            Ok(applied) if usize::try_from(applied).unwrap_or(0) < batch.count => {
+                log::warn!(
+                    "apply sepolicy batch partially succeeded: {applied}/{}",
+                    batch.count
+                );
+            }
+            Ok(_) => {}
+            // a batch the kernel can't read, pre-5.10 may have applied the chunks
+            // before the bad command, so this is a failure and not a fallback
+            Err(e) if e.raw_os_error() == Some(libc::EINVAL) => {
+                if hit {
+                    let _ = std::fs::remove_file(cache);
+                }
+                bail!("kernel rejected the sepolicy batch, it may be partly applied: {e}");
+            }
+            Err(e) => bail!("apply sepolicy batch failed: {e}"),
+        }
+    }
+
+    if !hit && let Err(e) = store_rules_cache(cache, &key, &batch) {
+        log::warn!("Failed to store sepolicy cache: {e}");
+    }
+    Ok(true)
+}
+
 pub fn check_rule(policy: &str) -> Result<()> {
     let path = Path::new(policy);
     let policy = if path.exists() {
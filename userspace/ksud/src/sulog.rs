@@ -2,7 +2,7 @@ use anyhow::{Context, Result, bail, ensure};
 use chrono::{Days, Local, NaiveDate};
 use std::fmt::Write as FmtWrite;
 use std::fs::{self, DirBuilder, File, OpenOptions, Permissions};
-use std::io::{self, ErrorKind, LineWriter, Write};
+use std::io::{self, ErrorKind, Write};
 use std::mem::size_of;
 use std::os::fd::{AsRawFd, FromRawFd, OwnedFd, RawFd};
 use std::os::unix::fs::{DirBuilderExt, OpenOptionsExt, PermissionsExt};
@@ -10,9 +10,9 @@ use std::os::unix::process::CommandExt;
 use std::path::{Path, PathBuf};
 use std::process::{Command, Stdio};
 use std::thread;
-use std::time::Duration;
+use std::time::{Duration, Instant};
 
-use crate::{defs, ksucalls, module_config, utils};
+use crate::{defs, ksucalls, lz4, module_config, utils};
 
 const KSU_EVENT_QUEUE_TYPE_DROPPED: u16 = u16::MAX;
 const KSU_EVENT_RECORD_FLAG_INTERNAL: u16 = 1;
@@ -24,8 +24,17 @@ const SULOG_FILE_MODE: u32 = 0o600;
 pub const SULOG_CONFIG_MODULE_ID: &str = "internal.ksud.sulogd";
 const SULOG_RETENTION_CONFIG_KEY: &str = "log.retention.days";
 const SULOG_MAX_FILE_SIZE_CONFIG_KEY: &str = "log.max_file_size";
+const SULOG_RETENTION_BYTES_CONFIG_KEY: &str = "log.retention.bytes";
+const SULOG_COMPRESS_CONFIG_KEY: &str = "log.compress";
 const DEFAULT_SULOG_RETENTION_DAYS: u64 = 3;
 const DEFAULT_SULOG_MAX_FILE_SIZE: u64 = 10 * 1024 * 1024;
+const DEFAULT_SULOG_RETENTION_BYTES: u64 = 32 * 1024 * 1024;
+const SULOG_LOG_SUFFIX: &str = ".log";
+const SULOG_COMPRESSED_SUFFIX: &str = ".log.lz4";
+const SULOG_COMPRESS_BLOCK_SIZE: usize = 64 * 1024;
+const SULOG_FLUSH_THRESHOLD: usize = 64 * 1024;
+const SULOG_FLUSH_INTERVAL: Duration = Duration::from_secs(2);
+const SULOG_STATS_WINDOW: u64 = 10_000;
 
 #[repr(C, packed)]
 #[derive(Clone, Copy, Debug)]
@@ -90,12 +99,29 @@ struct SulogdLockGuard {
     _lock_file: File,
 }
 
+/// Write accounting for one `SULOG_STATS_WINDOW` of events.
+#[derive(Clone, Copy, Debug, Default)]
+struct WriteStats {
+    events: u64,
+    write_calls: u64,
+    bytes_written: u64,
+}
+
+/// Appends sulog lines to the current daily segment.
+///
+/// Lines are staged in memory and written out once `SULOG_FLUSH_THRESHOLD`
+/// bytes are pending or the oldest pending line is `SULOG_FLUSH_INTERVAL`
+/// old, so a burst of su events costs a handful of writes instead of one
+/// per event. Segments are only fsynced when they are sealed on rotation.
 struct DailyLogWriter {
     current_day: String,
     current_index: u32,
     current_size: u64,
-    max_file_size: u64,
-    writer: LineWriter<File>,
+    config: SulogConfig,
+    file: File,
+    buffer: Vec<u8>,
+    pending_since: Option<Instant>,
+    stats: WriteStats,
 }
 
 impl EventRecordHeader {
@@ -197,45 +223,153 @@ impl DailyLogWriter {
     fn open() -> Result<Self> {
         ensure_private_dir_exists(Path::new(defs::LOG_DIR))?;
         let config = ensure_sulog_config()?;
-        cleanup_expired_logs(config.retention_days)?;
+        cleanup_logs(&config, None)?;
         let current_day = current_log_day();
-        let (current_index, current_size, writer) =
-            open_log_writer_for_day(&current_day, config.max_file_size)?;
+        let (current_index, current_size, file) =
+            open_log_file_for_day(&current_day, config.max_file_size)?;
         Ok(Self {
             current_day,
             current_index,
             current_size,
-            max_file_size: config.max_file_size,
-            writer,
+            config,
+            file,
+            buffer: Vec::with_capacity(SULOG_FLUSH_THRESHOLD),
+            pending_since: None,
+            stats: WriteStats::default(),
         })
     }
 
+    fn current_path(&self) -> PathBuf {
+        daily_log_path(&self.current_day, self.current_index)
+    }
+
     fn rotate_if_needed(&mut self, next_write_len: usize) -> Result<()> {
         let current_day = current_log_day();
         let next_write_len = u64::try_from(next_write_len).context("invalid log line length")?;
         if current_day != self.current_day {
+            self.seal()?;
             let config = ensure_sulog_config()?;
-            cleanup_expired_logs(config.retention_days)?;
-            let (current_index, current_size, writer) =
-                open_log_writer_for_day(&current_day, config.max_file_size)?;
-            self.writer = writer;
+            cleanup_logs(&config, None)?;
+            let (current_index, current_size, file) =
+                open_log_file_for_day(&current_day, config.max_file_size)?;
+            self.file = file;
             self.current_day = current_day;
             self.current_index = current_index;
             self.current_size = current_size;
-            self.max_file_size = config.max_file_size;
+            self.config = config;
             return Ok(());
         }
 
         if self.current_size > 0
-            && self.current_size.saturating_add(next_write_len) > self.max_file_size
+            && self.current_size.saturating_add(next_write_len) > self.config.max_file_size
         {
+            self.seal()?;
             self.current_index = self.current_index.saturating_add(1);
-            let path = daily_log_path(&self.current_day, self.current_index);
-            self.writer = open_line_writer(&path)?;
+            self.file = open_log_file(&self.current_path())?;
             self.current_size = 0;
+            cleanup_logs(&self.config, Some(&self.current_path()))?;
+        }
+        Ok(())
+    }
+
+    /// Flush and fsync the current segment, then compress it if enabled.
+    fn seal(&mut self) -> Result<()> {
+        self.flush().context("failed to flush sulog segment")?;
+        let path = self.current_path();
+        self.file
+            .sync_all()
+            .with_context(|| format!("failed to fsync {}", path.display()))?;
+        if self.config.compress {
+            compress_log_segment(&path)?;
         }
         Ok(())
     }
+
+    fn append_line(&mut self, line: &str) -> io::Result<()> {
+        let write_len = line
+            .len()
+            .checked_add(1)
+            .ok_or_else(|| io::Error::other("sulog line length overflow"))?;
+        self.rotate_if_needed(write_len).map_err(io::Error::other)?;
+        self.buffer.extend_from_slice(line.as_bytes());
+        self.buffer.push(b'\n');
+        self.pending_since.get_or_insert_with(Instant::now);
+        self.current_size = self
+            .current_size
+            .saturating_add(u64::try_from(write_len).map_err(io::Error::other)?);
+        if self.buffer.len() >= SULOG_FLUSH_THRESHOLD {
+            self.flush()?;
+        }
+        self.account_event();
+        Ok(())
+    }
+
+    fn flush(&mut self) -> io::Result<()> {
+        let mut written = 0usize;
+        while written < self.buffer.len() {
+            match self.file.write(&self.buffer[written..]) {
+                Ok(0) => return Err(ErrorKind::WriteZero.into()),
+                Ok(len) => {
+                    written += len;
+                    self.stats.write_calls = self.stats.write_calls.saturating_add(1);
+                    self.stats.bytes_written = self
+                        .stats
+                        .bytes_written
+                        .saturating_add(u64::try_from(len).map_err(io::Error::other)?);
+                }
+                Err(err) if err.kind() == ErrorKind::Interrupted => {}
+                Err(err) => {
+                    self.buffer.drain(..written);
+                    return Err(err);
+                }
+            }
+        }
+        self.buffer.clear();
+        self.pending_since = None;
+        Ok(())
+    }
+
+    fn flush_if_due(&mut self) -> io::Result<()> {
+        if self
+            .pending_since
+            .is_some_and(|since| since.elapsed() >= SULOG_FLUSH_INTERVAL)
+        {
+            self.flush()?;
+        }
+        Ok(())
+    }
+
+    /// epoll timeout until the pending buffer must be flushed, -1 if idle.
+    fn flush_timeout_ms(&self) -> i32 {
+        self.pending_since.map_or(-1, |since| {
+            let remaining = SULOG_FLUSH_INTERVAL.saturating_sub(since.elapsed());
+            i32::try_from(remaining.as_millis()).unwrap_or(i32::MAX)
+        })
+    }
+
+    fn account_event(&mut self) {
+        self.stats.events = self.stats.events.saturating_add(1);
+        if self.stats.events < SULOG_STATS_WINDOW {
+            return;
+        }
+        let WriteStats {
+            events,
+            write_calls,
+            bytes_written,
+        } = self.stats;
+        log::info!(
+            "sulogd wrote {events} events with {write_calls} write syscalls, {bytes_written} bytes"
+        );
+        self.stats = WriteStats::default();
+    }
+}
+
+impl Drop for DailyLogWriter {
+    fn drop(&mut self) {
+        if let Err(err) = self.flush() {
+            log::warn!("failed to flush pending sulog lines: {err}");
+        }
+    }
 }
 
 fn parse_c_string(bytes: &[u8]) -> String {
@@ -258,13 +392,19 @@ fn current_log_day() -> String {
 
 fn daily_log_path(day: &str, index: u32) -> PathBuf {
     let file_name = if index == 0 {
-        format!("sulog-{day}.log")
+        format!("sulog-{day}{SULOG_LOG_SUFFIX}")
     } else {
-        format!("sulog-{day}-{index}.log")
+        format!("sulog-{day}-{index}{SULOG_LOG_SUFFIX}")
     };
     Path::new(defs::LOG_DIR).join(file_name)
 }
 
+fn is_compressed_log(path: &Path) -> bool {
+    path.file_name()
+        .and_then(|name| name.to_str())
+        .is_some_and(|name| name.ends_with(SULOG_COMPRESSED_SUFFIX))
+}
+
 fn parse_retention_days(value: &str) -> Result<u64> {
     let days = value
         .trim()
@@ -289,10 +429,24 @@ fn parse_max_file_size(value: &str) -> Result<u64> {
     Ok(size)
 }
 
+fn parse_retention_bytes(value: &str) -> Result<u64> {
+    let bytes = value
+        .trim()
+        .parse::<u64>()
+        .with_context(|| format!("invalid {SULOG_RETENTION_BYTES_CONFIG_KEY} value: '{value}'"))?;
+    ensure!(
+        bytes > 0,
+        "{SULOG_RETENTION_BYTES_CONFIG_KEY} must be greater than 0"
+    );
+    Ok(bytes)
+}
+
 #[derive(Clone, Copy, Debug)]
 struct SulogConfig {
     retention_days: u64,
+    retention_bytes: u64,
     max_file_size: u64,
+    compress: bool,
 }
 
 fn ensure_config_value(key: &str, default_value: u64) -> Result<String> {
@@ -316,23 +470,30 @@ fn ensure_sulog_config() -> Result<SulogConfig> {
         SULOG_RETENTION_CONFIG_KEY,
         DEFAULT_SULOG_RETENTION_DAYS,
     )?)?;
+    let retention_bytes = parse_retention_bytes(&ensure_config_value(
+        SULOG_RETENTION_BYTES_CONFIG_KEY,
+        DEFAULT_SULOG_RETENTION_BYTES,
+    )?)?;
     let max_file_size = parse_max_file_size(&ensure_config_value(
         SULOG_MAX_FILE_SIZE_CONFIG_KEY,
         DEFAULT_SULOG_MAX_FILE_SIZE,
     )?)?;
+    let compress =
+        module_config::parse_bool_config(&ensure_config_value(SULOG_COMPRESS_CONFIG_KEY, 0)?);
     Ok(SulogConfig {
         retention_days,
+        retention_bytes,
         max_file_size,
+        compress,
     })
 }
 
-fn parse_log_date_from_path(path: &Path) -> Option<NaiveDate> {
-    parse_log_name(path).map(|(date, _)| date)
-}
-
 fn parse_log_name(path: &Path) -> Option<(NaiveDate, u32)> {
     let file_name = path.file_name()?.to_str()?;
-    let name = file_name.strip_prefix("sulog-")?.strip_suffix(".log")?;
+    let name = file_name.strip_prefix("sulog-")?;
+    let name = name
+        .strip_suffix(SULOG_COMPRESSED_SUFFIX)
+        .or_else(|| name.strip_suffix(SULOG_LOG_SUFFIX))?;
     let (date_str, index) = if name.len() == "YYYY-MM-DD".len() {
         (name, 0)
     } else if let Some((date_str, index_str)) = name.rsplit_once('-') {
@@ -349,39 +510,120 @@ fn parse_log_name(path: &Path) -> Option<(NaiveDate, u32)> {
     Some((NaiveDate::parse_from_str(date_str, "%Y-%m-%d").ok()?, index))
 }
 
-fn cleanup_expired_logs(retention_days: u64) -> Result<()> {
+/// Remove segments older than `retention_days`, then drop the oldest
+/// remaining segments until the directory fits in `retention_bytes`.
+/// `active` is never removed.
+fn cleanup_logs(config: &SulogConfig, active: Option<&Path>) -> Result<()> {
     let log_dir = Path::new(defs::LOG_DIR);
     if !log_dir.exists() {
         return Ok(());
     }
 
+    let retention_days = config.retention_days;
+    let retention_bytes = config.retention_bytes;
     let today = Local::now().date_naive();
     let cutoff = today
         .checked_sub_days(Days::new(retention_days.saturating_sub(1)))
         .context("failed to compute sulog retention cutoff")?;
 
+    let mut segments = Vec::new();
     for entry in
         fs::read_dir(log_dir).with_context(|| format!("failed to read {}", log_dir.display()))?
     {
         let entry = entry.with_context(|| format!("failed to read {}", log_dir.display()))?;
         let path = entry.path();
-        let Some(log_date) = parse_log_date_from_path(&path) else {
+        let Some((log_date, index)) = parse_log_name(&path) else {
             continue;
         };
 
-        if log_date < cutoff {
+        if log_date < cutoff && active != Some(path.as_path()) {
             fs::remove_file(&path)
                 .with_context(|| format!("failed to remove expired sulog {}", path.display()))?;
             log::info!(
                 "removed expired sulog log {}, retention_days={retention_days}",
                 path.display()
             );
+            continue;
         }
+
+        let size = entry.metadata().map_or(0, |meta| meta.len());
+        segments.push((log_date, index, path, size));
+    }
+
+    let mut total_size = segments
+        .iter()
+        .fold(0u64, |total, (_, _, _, size)| total.saturating_add(*size));
+    if total_size <= retention_bytes {
+        return Ok(());
+    }
+
+    segments.sort_by_key(|(log_date, index, _, _)| (*log_date, *index));
+    for (_, _, path, size) in segments {
+        if total_size <= retention_bytes {
+            break;
+        }
+        if active == Some(path.as_path()) {
+            continue;
+        }
+        fs::remove_file(&path)
+            .with_context(|| format!("failed to remove sulog {}", path.display()))?;
+        total_size = total_size.saturating_sub(size);
+        log::info!(
+            "removed sulog log {} over budget, retention_bytes={retention_bytes}",
+            path.display()
+        );
     }
 
     Ok(())
 }
 
+/// Replace a sealed plain-text segment with `<name>.lz4`.
+///
+/// The compressed file is a sequence of
+/// `[u32 raw_len][u32 compressed_len][lz4 block]` records, little endian,
+/// one per `SULOG_COMPRESS_BLOCK_SIZE` chunk of the original segment.
+fn compress_log_segment(path: &Path) -> Result<()> {
+    let raw = fs::read(path).with_context(|| format!("failed to read {}", path.display()))?;
+    if raw.is_empty() {
+        return Ok(());
+    }
+
+    let mut target = path.as_os_str().to_owned();
+    target.push(".lz4");
+    let target = PathBuf::from(target);
+    let mut file = OpenOptions::new()
+        .create(true)
+        .write(true)
+        .truncate(true)
+        .mode(SULOG_FILE_MODE)
+        .open(&target)
+        .with_context(|| format!("failed to open {}", target.display()))?;
+
+    let mut compressed_size = 0usize;
+    for chunk in raw.chunks(SULOG_COMPRESS_BLOCK_SIZE) {
+        let block = lz4::compress_block(chunk);
+        let raw_len = u32::try_from(chunk.len()).context("sulog block too large")?;
+        let block_len = u32::try_from(block.len()).context("sulog block too large")?;
+        let mut record = Vec::with_capacity(block.len() + 8);
+        record.extend_from_slice(&raw_len.to_le_bytes());
+        record.extend_from_slice(&block_len.to_le_bytes());
+        record.extend_from_slice(&block);
+        file.write_all(&record)
+            .with_context(|| format!("failed to write {}", target.display()))?;
+        compressed_size += record.len();
+    }
+    file.sync_all()
+        .with_context(|| format!("failed to fsync {}", target.display()))?;
+    fs::remove_file(path).with_context(|| format!("failed to remove {}", path.display()))?;
+
+    log::info!(
+        "compressed sulog segment {}: {} -> {compressed_size} bytes",
+        path.display(),
+        raw.len()
+    );
+    Ok(())
+}
+
 fn ensure_private_dir_exists(path: &Path) -> Result<()> {
     DirBuilder::new()
         .recursive(true)
@@ -393,7 +635,7 @@ fn ensure_private_dir_exists(path: &Path) -> Result<()> {
     Ok(())
 }
 
-fn open_line_writer(path: &Path) -> Result<LineWriter<File>> {
+fn open_log_file(path: &Path) -> Result<File> {
     let file = OpenOptions::new()
         .create(true)
         .append(true)
@@ -408,12 +650,12 @@ fn open_line_writer(path: &Path) -> Result<LineWriter<File>> {
                 SULOG_FILE_MODE
             )
         })?;
-    Ok(LineWriter::new(file))
+    Ok(file)
 }
 
-fn open_log_writer_for_day(day: &str, max_file_size: u64) -> Result<(u32, u64, LineWriter<File>)> {
-    let mut highest_index = 0u32;
-    let mut found = false;
+fn open_log_file_for_day(day: &str, max_file_size: u64) -> Result<(u32, u64, File)> {
+    let current_date = NaiveDate::parse_from_str(day, "%Y-%m-%d").context("invalid current day")?;
+    let mut highest: Option<(u32, bool)> = None;
     for entry in
         fs::read_dir(defs::LOG_DIR).with_context(|| format!("failed to read {}", defs::LOG_DIR))?
     {
@@ -422,13 +664,27 @@ fn open_log_writer_for_day(day: &str, max_file_size: u64) -> Result<(u32, u64, L
         let Some((log_date, index)) = parse_log_name(&path) else {
             continue;
         };
-        if log_date == NaiveDate::parse_from_str(day, "%Y-%m-%d").context("invalid current day")? {
-            highest_index = highest_index.max(index);
-            found = true;
+        if log_date != current_date {
+            continue;
         }
+        let sealed = is_compressed_log(&path);
+        highest = match highest {
+            Some((highest_index, highest_sealed)) if highest_index == index => {
+                Some((index, highest_sealed || sealed))
+            }
+            Some((highest_index, _)) if highest_index > index => highest,
+            _ => Some((index, sealed)),
+        };
     }
 
-    let mut index = if found { highest_index } else { 0 };
+    // A compressed segment is sealed, continue with the next index.
+    let mut index = highest.map_or(0, |(index, sealed)| {
+        if sealed {
+            index.saturating_add(1)
+        } else {
+            index
+        }
+    });
     let mut path = daily_log_path(day, index);
     let mut current_size = fs::metadata(&path).map_or(0, |meta| meta.len());
     if current_size >= max_file_size && current_size > 0 {
@@ -437,8 +693,8 @@ fn open_log_writer_for_day(day: &str, max_file_size: u64) -> Result<(u32, u64, L
         current_size = fs::metadata(&path).map_or(0, |meta| meta.len());
     }
 
-    let writer = open_line_writer(&path)?;
-    Ok((index, current_size, writer))
+    let file = open_log_file(&path)?;
+    Ok((index, current_size, file))
 }
 
 fn read_boot_id() -> Result<String> {
@@ -526,20 +782,7 @@ fn format_dropped_line(header: &EventRecordHeader, info: &DroppedInfo) -> String
 }
 
 fn write_log_line(writer: &mut DailyLogWriter, line: &str) -> io::Result<()> {
-    let write_len = line
-        .len()
-        .checked_add(1)
-        .ok_or_else(|| io::Error::other("sulog line length overflow"))?;
-    writer
-        .rotate_if_needed(write_len)
-        .map_err(io::Error::other)?;
-    writer.writer.write_all(line.as_bytes())?;
-    writer.writer.write_all(b"\n")?;
-    writer.writer.flush()?;
-    writer.current_size = writer
-        .current_size
-        .saturating_add(u64::try_from(write_len).map_err(io::Error::other)?);
-    Ok(())
+    writer.append_line(line)
 }
 
 fn format_record_line(header: EventRecordHeader, payload: &[u8]) -> Result<String> {
@@ -706,7 +949,7 @@ fn run_sulog_session(restart_count: u64) -> Result<SessionExitReason> {
                 epoll_fd.as_raw_fd(),
                 events.as_mut_ptr(),
                 i32::try_from(events.len()).context("too many epoll events")?,
-                -1,
+                writer.flush_timeout_ms(),
             )
         };
         if ready < 0 {
@@ -716,6 +959,9 @@ fn run_sulog_session(restart_count: u64) -> Result<SessionExitReason> {
             }
             return Err(err).context("epoll_wait failed for sulogd");
         }
+        writer
+            .flush_if_due()
+            .context("failed to flush sulog lines")?;
 
         let ready = usize::try_from(ready).context("invalid epoll ready count")?;
         for ready_event in &events[..ready] {
@@ -3,7 +3,7 @@ use log::{info, warn};
 use std::fs;
 use std::process::Command;
 
-use crate::utils;
+use crate::{ksucalls, utils};
 
 /// Find PIDs of processes running in the KernelSU su domain (u:r:ksu:s0).
 /// Returns a list of PIDs excluding our own.
@@ -36,10 +36,25 @@ fn find_su_domain_pids() -> Vec<i32> {
     pids
 }
 
-/// Find PIDs of processes holding ksu_driver or ksu_fdwrapper file descriptors.
+/// Find PIDs of processes holding ksu_driver, ksu_sulog or ksu_fdwrapper file descriptors.
 /// Returns a list of PIDs excluding our own.
 fn find_ksu_fd_holders() -> Vec<i32> {
     let my_pid = std::process::id() as i32;
+
+    // the kernel tracks the fds it hands out, one ioctl instead of a readlink per fd
+    match ksucalls::fd_holders() {
+        Ok(holders) => {
+            let mut pids: Vec<i32> = holders
+                .into_iter()
+                .map(|(pid, _, _)| pid)
+                .filter(|&pid| pid != my_pid)
+                .collect();
+            pids.dedup();
+            return pids;
+        }
+        Err(e) => info!("unload: fd holder query unavailable ({e}), scanning /proc"),
+    }
+
     let mut pids = Vec::new();
 
     let Ok(entries) = fs::read_dir("/proc") else {
@@ -64,7 +79,10 @@ fn find_ksu_fd_holders() -> Vec<i32> {
             let link_path = fd_entry.path();
             if let Ok(target) = fs::read_link(&link_path) {
                 let target_str = target.to_string_lossy();
-                if target_str.contains("[ksu_driver]") || target_str.contains("[ksu_fdwrapper]") {
+                if target_str.contains("[ksu_driver]")
+                    || target_str.contains("[ksu_sulog]")
+                    || target_str.contains("[ksu_fdwrapper]")
+                {
                     pids.push(pid);
                     break;
                 }